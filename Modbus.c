@@ -7,8 +7,12 @@
  */
 
 #include "Modbus.h"
+#include "ModbusRegisterBank.h"
+#include "ModbusAddressIndex.h"
+#include "ModbusMasterEngine.h"
+#include "ModbusPack.h"
 
-static uint16_t Modbus_ReadUint16_From_2Bytes(uint8_t *pos)
+uint16_t Modbus_ReadUint16_From_2Bytes(const uint8_t *pos)
 {
     //modbus的16位数据高字节在前,低字节在后
     uint16_t ret=pos[0];
@@ -18,16 +22,18 @@ static uint16_t Modbus_ReadUint16_From_2Bytes(uint8_t *pos)
     return ret;
 };
 
-static void Modbus_WriteUint16_To_2Bytes(uint8_t *pos,uint16_t dat)
+void Modbus_WriteUint16_To_2Bytes(uint8_t *pos,uint16_t dat)
 {
     //modbus的16位数据高字节在前,低字节在后
     pos[0]=(dat>>8);
     pos[1]=(dat&0xff);
 }
 
-static uint16_t CRC16(uint8_t *arr_buff,size_t len)
+/*
+CRC16逐位计算(参考实现,多项式0xA001),crc:初始值
+*/
+static uint16_t CRC16_Bitwise(uint16_t crc,const uint8_t *arr_buff,size_t len)
 {
-    uint16_t crc=0xFFFF;
     size_t  i, j;
     for ( j=0; j<len; j++)
     {
@@ -46,6 +52,222 @@ static uint16_t CRC16(uint8_t *arr_buff,size_t len)
     return ( crc);
 }
 
+/*
+CRC16表(多项式0xA001),每项为单字节的CRC余数
+*/
+static const uint16_t CRC16_Table[256]=
+{
+    0x0000,0xC0C1,0xC181,0x0140,0xC301,0x03C0,0x0280,0xC241,
+    0xC601,0x06C0,0x0780,0xC741,0x0500,0xC5C1,0xC481,0x0440,
+    0xCC01,0x0CC0,0x0D80,0xCD41,0x0F00,0xCFC1,0xCE81,0x0E40,
+    0x0A00,0xCAC1,0xCB81,0x0B40,0xC901,0x09C0,0x0880,0xC841,
+    0xD801,0x18C0,0x1980,0xD941,0x1B00,0xDBC1,0xDA81,0x1A40,
+    0x1E00,0xDEC1,0xDF81,0x1F40,0xDD01,0x1DC0,0x1C80,0xDC41,
+    0x1400,0xD4C1,0xD581,0x1540,0xD701,0x17C0,0x1680,0xD641,
+    0xD201,0x12C0,0x1380,0xD341,0x1100,0xD1C1,0xD081,0x1040,
+    0xF001,0x30C0,0x3180,0xF141,0x3300,0xF3C1,0xF281,0x3240,
+    0x3600,0xF6C1,0xF781,0x3740,0xF501,0x35C0,0x3480,0xF441,
+    0x3C00,0xFCC1,0xFD81,0x3D40,0xFF01,0x3FC0,0x3E80,0xFE41,
+    0xFA01,0x3AC0,0x3B80,0xFB41,0x3900,0xF9C1,0xF881,0x3840,
+    0x2800,0xE8C1,0xE981,0x2940,0xEB01,0x2BC0,0x2A80,0xEA41,
+    0xEE01,0x2EC0,0x2F80,0xEF41,0x2D00,0xEDC1,0xEC81,0x2C40,
+    0xE401,0x24C0,0x2580,0xE541,0x2700,0xE7C1,0xE681,0x2640,
+    0x2200,0xE2C1,0xE381,0x2340,0xE101,0x21C0,0x2080,0xE041,
+    0xA001,0x60C0,0x6180,0xA141,0x6300,0xA3C1,0xA281,0x6240,
+    0x6600,0xA6C1,0xA781,0x6740,0xA501,0x65C0,0x6480,0xA441,
+    0x6C00,0xACC1,0xAD81,0x6D40,0xAF01,0x6FC0,0x6E80,0xAE41,
+    0xAA01,0x6AC0,0x6B80,0xAB41,0x6900,0xA9C1,0xA881,0x6840,
+    0x7800,0xB8C1,0xB981,0x7940,0xBB01,0x7BC0,0x7A80,0xBA41,
+    0xBE01,0x7EC0,0x7F80,0xBF41,0x7D00,0xBDC1,0xBC81,0x7C40,
+    0xB401,0x74C0,0x7580,0xB541,0x7700,0xB7C1,0xB681,0x7640,
+    0x7200,0xB2C1,0xB381,0x7340,0xB101,0x71C0,0x7080,0xB041,
+    0x5000,0x90C1,0x9181,0x5140,0x9301,0x53C0,0x5280,0x9241,
+    0x9601,0x56C0,0x5780,0x9741,0x5500,0x95C1,0x9481,0x5440,
+    0x9C01,0x5CC0,0x5D80,0x9D41,0x5F00,0x9FC1,0x9E81,0x5E40,
+    0x5A00,0x9AC1,0x9B81,0x5B40,0x9901,0x59C0,0x5880,0x9841,
+    0x8801,0x48C0,0x4980,0x8941,0x4B00,0x8BC1,0x8A81,0x4A40,
+    0x4E00,0x8EC1,0x8F81,0x4F40,0x8D01,0x4DC0,0x4C80,0x8C41,
+    0x4400,0x84C1,0x8581,0x4540,0x8701,0x47C0,0x4680,0x8641,
+    0x8201,0x42C0,0x4380,0x8341,0x4100,0x81C1,0x8081,0x4040,
+};
+
+static uint16_t CRC16_Table_Driven(uint16_t crc,const uint8_t *arr_buff,size_t len)
+{
+    while(len--)
+    {
+        crc=(crc>>8)^CRC16_Table[(crc^(*arr_buff++))&0xff];
+    }
+    return crc;
+}
+
+#ifndef MODBUS_CRC_DISABLE_SLICE
+/*
+slice-by-N使用的表,CRC16_Slice_Table[k][i]为字节i后跟k个0字节的CRC余数。
+占用4KB RAM,可通过定义MODBUS_CRC_DISABLE_SLICE宏裁剪。
+*/
+static uint16_t CRC16_Slice_Table[8][256];
+static bool CRC16_Slice_Table_Ready=false;
+
+static void CRC16_Slice_Table_Init(void)
+{
+    if(CRC16_Slice_Table_Ready)
+    {
+        return;
+    }
+    for(size_t i=0; i<256; i++)
+    {
+        CRC16_Slice_Table[0][i]=CRC16_Table[i];
+    }
+    for(size_t k=1; k<8; k++)
+    {
+        for(size_t i=0; i<256; i++)
+        {
+            uint16_t crc=CRC16_Slice_Table[k-1][i];
+            CRC16_Slice_Table[k][i]=(crc>>8)^CRC16_Table[crc&0xff];
+        }
+    }
+    CRC16_Slice_Table_Ready=true;
+}
+
+static uint16_t CRC16_Slice4(uint16_t crc,const uint8_t *arr_buff,size_t len)
+{
+    while(len>=4)
+    {
+        crc=CRC16_Slice_Table[3][(arr_buff[0]^crc)&0xff]
+            ^CRC16_Slice_Table[2][(arr_buff[1]^(crc>>8))&0xff]
+            ^CRC16_Slice_Table[1][arr_buff[2]]
+            ^CRC16_Slice_Table[0][arr_buff[3]];
+        arr_buff+=4;
+        len-=4;
+    }
+    return CRC16_Table_Driven(crc,arr_buff,len);
+}
+
+static uint16_t CRC16_Slice8(uint16_t crc,const uint8_t *arr_buff,size_t len)
+{
+    while(len>=8)
+    {
+        crc=CRC16_Slice_Table[7][(arr_buff[0]^crc)&0xff]
+            ^CRC16_Slice_Table[6][(arr_buff[1]^(crc>>8))&0xff]
+            ^CRC16_Slice_Table[5][arr_buff[2]]
+            ^CRC16_Slice_Table[4][arr_buff[3]]
+            ^CRC16_Slice_Table[3][arr_buff[4]]
+            ^CRC16_Slice_Table[2][arr_buff[5]]
+            ^CRC16_Slice_Table[1][arr_buff[6]]
+            ^CRC16_Slice_Table[0][arr_buff[7]];
+        arr_buff+=8;
+        len-=8;
+    }
+    return CRC16_Table_Driven(crc,arr_buff,len);
+}
+#endif // MODBUS_CRC_DISABLE_SLICE
+
+static modbus_crc_backend_t CRC16_Backend=MODBUS_CRC_BACKEND_TABLE;
+
+static uint16_t CRC16_Update(modbus_crc_backend_t backend,uint16_t crc,const uint8_t *arr_buff,size_t len)
+{
+    switch(backend)
+    {
+    case MODBUS_CRC_BACKEND_TABLE:
+        return CRC16_Table_Driven(crc,arr_buff,len);
+#ifndef MODBUS_CRC_DISABLE_SLICE
+    case MODBUS_CRC_BACKEND_SLICE4:
+        return CRC16_Slice4(crc,arr_buff,len);
+    case MODBUS_CRC_BACKEND_SLICE8:
+        return CRC16_Slice8(crc,arr_buff,len);
+#endif // MODBUS_CRC_DISABLE_SLICE
+    default:
+        return CRC16_Bitwise(crc,arr_buff,len);
+    }
+}
+
+static uint16_t CRC16(uint8_t *arr_buff,size_t len)
+{
+    return CRC16_Update(CRC16_Backend,0xFFFF,arr_buff,len);
+}
+
+bool Modbus_CRC_Set_Backend(modbus_crc_backend_t backend)
+{
+    switch(backend)
+    {
+    case MODBUS_CRC_BACKEND_BITWISE:
+    case MODBUS_CRC_BACKEND_TABLE:
+        break;
+#ifndef MODBUS_CRC_DISABLE_SLICE
+    case MODBUS_CRC_BACKEND_SLICE4:
+    case MODBUS_CRC_BACKEND_SLICE8:
+        CRC16_Slice_Table_Init();
+        break;
+    case MODBUS_CRC_BACKEND_AUTO:
+        CRC16_Slice_Table_Init();
+        backend=MODBUS_CRC_BACKEND_SLICE8;
+        break;
+#else
+    case MODBUS_CRC_BACKEND_AUTO:
+        backend=MODBUS_CRC_BACKEND_TABLE;
+        break;
+#endif // MODBUS_CRC_DISABLE_SLICE
+    default:
+        return false;
+    }
+
+    CRC16_Backend=backend;
+    return true;
+}
+
+modbus_crc_backend_t Modbus_CRC_Get_Backend(void)
+{
+    return CRC16_Backend;
+}
+
+bool Modbus_CRC_Self_Test(void)
+{
+    static const modbus_crc_backend_t backends[]=
+    {
+        MODBUS_CRC_BACKEND_TABLE,
+#ifndef MODBUS_CRC_DISABLE_SLICE
+        MODBUS_CRC_BACKEND_SLICE4,
+        MODBUS_CRC_BACKEND_SLICE8,
+#endif // MODBUS_CRC_DISABLE_SLICE
+    };
+
+    //标准校验值:CRC-16/MODBUS("123456789")=0x4B37
+    if(CRC16_Bitwise(0xFFFF,(const uint8_t *)"123456789",9)!=0x4B37)
+    {
+        return false;
+    }
+
+#ifndef MODBUS_CRC_DISABLE_SLICE
+    CRC16_Slice_Table_Init();
+#endif // MODBUS_CRC_DISABLE_SLICE
+
+    //使用伪随机数据及各种长度(含非对齐起始地址)与逐位计算结果比较
+    uint8_t data[MODBUS_RTU_MAX_ADU_LENGTH+8];
+    uint32_t seed=0x12345678;
+    for(size_t i=0; i<sizeof(data); i++)
+    {
+        seed=seed*1103515245+12345;
+        data[i]=(seed>>16);
+    }
+
+    for(size_t offset=0; offset<8; offset++)
+    {
+        for(size_t len=0; len<=MODBUS_RTU_MAX_ADU_LENGTH; len++)
+        {
+            uint16_t crc=CRC16_Bitwise(0xFFFF,&data[offset],len);
+            for(size_t i=0; i<sizeof(backends)/sizeof(backends[0]); i++)
+            {
+                if(CRC16_Update(backends[i],0xFFFF,&data[offset],len)!=crc)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
 /*
 	检查数据的crc,payload：整帧数据(包含CRC),payload_length:长度(包含CRC)
 */
@@ -65,6 +287,30 @@ bool Modbus_Payload_Check_CRC(uint8_t *payload,size_t payload_length)
 
 }
 
+/*
+	检查分段数据的crc,iov：整帧数据(包含CRC)的各段,iov_count:分段数量
+*/
+bool Modbus_Payload_Check_CRC_IOV(const modbus_iovec_t *iov,size_t iov_count)
+{
+    if(iov==NULL)
+    {
+        return false;
+    }
+
+    modbus_crc_state_t crc;
+    Modbus_CRC_Init(&crc);
+    for(size_t i=0; i<iov_count; i++)
+    {
+        if(iov[i].base==NULL && iov[i].length!=0)
+        {
+            return false;
+        }
+        Modbus_CRC_Update(&crc,iov[i].base,iov[i].length);
+    }
+
+    return Modbus_CRC_Check(&crc);
+}
+
 /*
 	添加末尾的crc校验,payload：整帧数据(不包含CRC),payload_length:长度(包含CRC)
 */
@@ -84,784 +330,1415 @@ bool Modbus_Payload_Append_CRC(uint8_t *payload,size_t payload_length)
 }
 
 /*
-Modbus从机解析输入。ctx：上下文指针,input_data:输入数据指针,input_data_length:输入数据长度,buff:缓冲(存放临时数据),buff_length:缓冲长度
+初始化CRC计算状态
 */
+void Modbus_CRC_Init(modbus_crc_state_t *state)
+{
+    if(state==NULL)
+    {
+        return;
+    }
+    state->crc=0xFFFF;
+    state->length=0;
+}
 
-bool Modbus_Slave_Parse_Input(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,uint8_t *buff,size_t buff_length)
+/*
+将数据并入CRC计算状态
+*/
+void Modbus_CRC_Update(modbus_crc_state_t *state,const uint8_t *data,size_t data_length)
 {
-    if(ctx==NULL  || input_data ==NULL || input_data_length <=2 || buff==NULL || buff_length <=2 || buff_length<input_data_length)
+    if(state==NULL || data==NULL || data_length==0)
     {
-        return false;
+        return;
     }
+    state->crc=CRC16_Update(CRC16_Backend,state->crc,data,data_length);
+    state->length+=data_length;
+}
 
-    if(!Modbus_Payload_Check_CRC(input_data,input_data_length))
+/*
+获取当前的CRC值
+*/
+uint16_t Modbus_CRC_Final(const modbus_crc_state_t *state)
+{
+    if(state==NULL)
+    {
+        return 0xFFFF;
+    }
+    return state->crc;
+}
+
+/*
+检查整帧(包含CRC)的CRC计算状态。
+Modbus CRC无输出异或,若CRC(低字节在前)追加在数据末尾,则整帧的CRC余数为0。
+*/
+bool Modbus_CRC_Check(const modbus_crc_state_t *state)
+{
+    if(state==NULL || state->length<=2)
     {
         return false;
     }
+    return state->crc==0;
+}
 
-    size_t output_length=0;
+/*
+预测请求帧(主机发往从机)的长度,data:已接收的数据,data_length:已接收的数据长度
+*/
+int Modbus_RTU_Predict_Request_Length(const uint8_t *data,size_t data_length)
+{
+    if(data==NULL || data_length<2)
+    {
+        return 0;
+    }
 
-    switch(input_data[1])
+    switch(data[1])
     {
     case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x05:
+    case 0x06:
+    case 0x08:
+        return 8;
+    case 0x07:
+    case 0x0B:
+    case 0x0C:
+    case 0x11:
+        return 4;
+    case 0x0F:
+    case 0x10:
+        //字节数位于第7字节
+        return (data_length<7)?0:(9+data[6]);
+    case 0x14:
+    case 0x15:
+        return (data_length<3)?0:(5+data[2]);
+    case 0x16:
+        return 10;
+    case 0x17:
+        //写字节数位于第11字节
+        return (data_length<11)?0:(13+data[10]);
+    case 0x18:
+        return 6;
+    default:
+        return -1;
+    }
+}
+
+/*
+预测回应帧(从机发往主机)的长度,data:已接收的数据,data_length:已接收的数据长度
+*/
+int Modbus_RTU_Predict_Response_Length(const uint8_t *data,size_t data_length)
+{
+    if(data==NULL || data_length<2)
+    {
+        return 0;
+    }
+
+    if((data[1]&0x80)!=0)
+    {
+        //异常回应
+        return 5;
+    }
+
+    switch(data[1])
+    {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x0C:
+    case 0x11:
+    case 0x14:
+    case 0x15:
+    case 0x17:
+        return (data_length<3)?0:(5+data[2]);
+    case 0x05:
+    case 0x06:
+    case 0x08:
+    case 0x0B:
+    case 0x0F:
+    case 0x10:
+        return 8;
+    case 0x07:
+        return 5;
+    case 0x16:
+        return 10;
+    case 0x18:
+        return (data_length<4)?0:(6+Modbus_ReadUint16_From_2Bytes(&data[2]));
+    default:
+        return -1;
+    }
+}
+
+/*
+由MBAP报文头得到TCP帧的长度,data:已接收的数据,data_length:已接收的数据长度
+*/
+int Modbus_TCP_Predict_Length(const uint8_t *data,size_t data_length)
+{
+    if(data==NULL || data_length<MODBUS_TCP_MBAP_LENGTH-1)
+    {
+        return 0;
+    }
+
+    //长度为单元标识及PDU(至少包含功能码)的长度
+    uint16_t length=Modbus_ReadUint16_From_2Bytes(&data[4]);
+    if(Modbus_ReadUint16_From_2Bytes(&data[2])!=0 || length<2 || length>MODBUS_MAX_PDU_LENGTH+1)
+    {
+        return -1;
+    }
+
+    return MODBUS_TCP_MBAP_LENGTH-1+length;
+}
+
+void Modbus_TCP_Write_MBAP(uint8_t *header,uint16_t transaction_id,size_t length)
+{
+    if(header==NULL)
+    {
+        return;
+    }
+
+    Modbus_WriteUint16_To_2Bytes(&header[0],transaction_id);
+    Modbus_WriteUint16_To_2Bytes(&header[2],0);
+    Modbus_WriteUint16_To_2Bytes(&header[4],length);
+}
+
+/*
+检查请求是否直接使用寄存器存储
+*/
+static bool Modbus_Slave_Use_Bank(modbus_slave_context_t *ctx,modbus_table_t table,size_t addr,size_t number,bool write)
+{
+    if(ctx->bank==NULL || !Modbus_Register_Bank_Contains(ctx->bank,table,addr,number))
+    {
+        return false;
+    }
+
+    return ctx->bank->intercept==NULL || !ctx->bank->intercept(ctx->bank,table,addr,number,write);
+}
+
+/*
+请求的地址不由寄存器存储、稀疏地址索引或回调函数处理时的异常码:
+使用了寄存器存储中的此表或稀疏地址索引时为地址非法,否则为不支持此功能。
+*/
+static modbus_exception_t Modbus_Slave_Miss(modbus_slave_context_t *ctx,modbus_table_t table)
+{
+    if((ctx->bank!=NULL && ctx->bank->tables[table].size!=0) || ctx->index!=NULL)
+    {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    return MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+}
+
+/*
+从机读取线圈(0x01)或输入线圈(0x02),优先使用批量回调。data:按位打包的输出(低位在前)
+*/
+static modbus_exception_t Modbus_Slave_Read_Bits(modbus_slave_context_t *ctx,uint8_t function_code,size_t start_addr,size_t length,uint8_t *data)
+{
+    bool (*read_bits)(size_t addr,uint8_t *data,size_t number)=(function_code==0x01)?ctx->read_OXs:ctx->read_IXs;
+    bool (*read_bit)(size_t addr)=(function_code==0x01)?ctx->read_OX:ctx->read_IX;
+    size_t byte_count=length/8+((length%8!=0)?1:0);
+    modbus_table_t table=(function_code==0x01)?MODBUS_TABLE_OX:MODBUS_TABLE_IX;
+
+    if(Modbus_Slave_Use_Bank(ctx,table,start_addr,length,false))
     {
-        //读取线圈
+        return Modbus_Register_Bank_Read_Bits(ctx->bank,table,start_addr,data,length)?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
 
-        if(input_data[0]!=ctx->slave_addr)
+    const modbus_address_block_t *block=Modbus_Address_Index_Find(ctx->index,table,start_addr,length);
+    if(block!=NULL)
+    {
+        if(block->range.data==NULL && block->read_bits==NULL)
         {
-            //非本从机
-            break;
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
         }
+        return Modbus_Address_Block_Read_Bits(block,start_addr,data,length)?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
+
+    memset(data,0,byte_count);
 
-        if(input_data!=buff)
+    if(read_bits!=NULL)
+    {
+        if(!read_bits(start_addr,data,length))
+        {
+            return MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+        }
+        if(length%8!=0)
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            //多余的位填0
+            data[byte_count-1]&=(0xFF>>(8-length%8));
         }
+        return MODBUS_EXCEPTION_NONE;
+    }
+
+    if(read_bit==NULL)
+    {
+        return Modbus_Slave_Miss(ctx,table);
+    }
+
+    for(size_t i=0; i<length; i++)
+    {
+        if(read_bit(start_addr+i))
+        {
+            data[i/8]|=(0x01<<(i%8));
+        }
+    }
+
+    return MODBUS_EXCEPTION_NONE;
+}
+
+/*
+从机读取保持寄存器(0x03)或输入寄存器(0x04),优先使用批量回调。data:输出(高字节在前)
+*/
+static modbus_exception_t Modbus_Slave_Read_Registers(modbus_slave_context_t *ctx,uint8_t function_code,size_t start_addr,size_t length,uint8_t *data)
+{
+    bool (*read_registers)(size_t addr,uint16_t *data,size_t number)=(function_code==0x03)?ctx->read_hold_registers:ctx->read_input_registers;
+    uint16_t (*read_register)(size_t addr)=(function_code==0x03)?ctx->read_hold_register:ctx->read_input_register;
+    modbus_table_t table=(function_code==0x03)?MODBUS_TABLE_HOLD_REGISTER:MODBUS_TABLE_INPUT_REGISTER;
+
+    if(Modbus_Slave_Use_Bank(ctx,table,start_addr,length,false))
+    {
+        return Modbus_Register_Bank_Read_Registers(ctx->bank,table,start_addr,data,length)?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
 
+    const modbus_address_block_t *block=Modbus_Address_Index_Find(ctx->index,table,start_addr,length);
+    if(block!=NULL)
+    {
+        if(block->range.data==NULL && block->read_registers==NULL)
+        {
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+        return Modbus_Address_Block_Read_Registers(block,start_addr,data,length)?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
 
-        if(ctx->read_OX!=NULL)
+    if(read_registers!=NULL)
+    {
+        uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+        if(length>MODBUS_MAX_READ_REGISTERS)
+        {
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+        if(!read_registers(start_addr,registers,length))
         {
-            uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t length=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-            uint8_t byte_count=length/8+((length%8!=0)?1:0);
-            buff[2]=byte_count;
+            return MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+        }
+        Modbus_Pack_Registers(data,registers,length);
+        return MODBUS_EXCEPTION_NONE;
+    }
+
+    if(read_register==NULL)
+    {
+        return Modbus_Slave_Miss(ctx,table);
+    }
+
+    for(size_t i=0; i<length; i++)
+    {
+        Modbus_WriteUint16_To_2Bytes(&data[2*i],read_register(start_addr+i));
+    }
+
+    return MODBUS_EXCEPTION_NONE;
+}
+
+/*
+从机写线圈(0x05/0x0F),优先使用批量回调,并调用write_begin/write_commit。data:按位打包的数据(低位在前)
+*/
+static modbus_exception_t Modbus_Slave_Write_Bits(modbus_slave_context_t *ctx,uint8_t function_code,size_t start_addr,size_t length,const uint8_t *data)
+{
+    bool use_bank=Modbus_Slave_Use_Bank(ctx,MODBUS_TABLE_OX,start_addr,length,true);
+    const modbus_address_block_t *block=use_bank?NULL:Modbus_Address_Index_Find(ctx->index,MODBUS_TABLE_OX,start_addr,length);
+
+    if(block!=NULL && block->range.data==NULL && block->write_bits==NULL)
+    {
+        //只读的地址块
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+
+    if(!use_bank && block==NULL && ctx->write_OXs==NULL && ctx->write_OX==NULL)
+    {
+        return Modbus_Slave_Miss(ctx,MODBUS_TABLE_OX);
+    }
 
-            output_length=5+byte_count;
+    if(ctx->write_begin!=NULL && !ctx->write_begin(function_code,start_addr,length))
+    {
+        return MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
 
-            if(output_length>buff_length)
+    bool ret=true;
+    if(use_bank)
+    {
+        ret=Modbus_Register_Bank_Write_Bits(ctx->bank,MODBUS_TABLE_OX,start_addr,data,length);
+    }
+    else if(block!=NULL)
+    {
+        ret=Modbus_Address_Block_Write_Bits(block,start_addr,data,length);
+    }
+    else if(ctx->write_OXs!=NULL)
+    {
+        ret=ctx->write_OXs(start_addr,data,length);
+    }
+    else
+    {
+        for(size_t i=0; i<length; i++)
+        {
+            if((data[i/8]&(0x01<<(i%8)))!=0)
             {
-                break;
+                ctx->write_OX(start_addr+i,0xFF00);
             }
-
-            for(size_t i=0; i<length; i++)
+            else
             {
-                if(i%8==0)
-                {
-                    buff[3+i/8]=0xff;
-                }
-
-                if(ctx->read_OX(start_addr+i))
-                {
-                    buff[3+i/8]|=(0x01<<(i%8));
-                }
-                else
-                {
-                    buff[3+i/8]&=(~(0x01<<(i%8)));
-                }
+                ctx->write_OX(start_addr+i,0x0000);
             }
+        }
+    }
 
+    if(ctx->write_commit!=NULL)
+    {
+        ret=ctx->write_commit(ret) && ret;
+    }
+
+    return ret?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+}
+
+/*
+检查保持寄存器是否可写入(0x06/0x10/0x16/0x17)
+*/
+static modbus_exception_t Modbus_Slave_Check_Write_Registers(modbus_slave_context_t *ctx,size_t start_addr,size_t length)
+{
+    bool use_bank=Modbus_Slave_Use_Bank(ctx,MODBUS_TABLE_HOLD_REGISTER,start_addr,length,true);
+    const modbus_address_block_t *block=use_bank?NULL:Modbus_Address_Index_Find(ctx->index,MODBUS_TABLE_HOLD_REGISTER,start_addr,length);
 
+    if(block!=NULL && block->range.data==NULL && block->write_registers==NULL)
+    {
+        //只读的地址块
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+
+    if(!use_bank && block==NULL && ctx->write_hold_registers==NULL && ctx->write_hold_register==NULL)
+    {
+        return Modbus_Slave_Miss(ctx,MODBUS_TABLE_HOLD_REGISTER);
+    }
+
+    if(length>MODBUS_MAX_WRITE_REGISTERS)
+    {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+
+    return MODBUS_EXCEPTION_NONE;
+}
+
+/*
+写入保持寄存器,优先使用批量回调,不调用write_begin/write_commit(需先通过Modbus_Slave_Check_Write_Registers检查)。data:数据(高字节在前)
+*/
+static bool Modbus_Slave_Store_Registers(modbus_slave_context_t *ctx,size_t start_addr,size_t length,const uint8_t *data)
+{
+    bool use_bank=Modbus_Slave_Use_Bank(ctx,MODBUS_TABLE_HOLD_REGISTER,start_addr,length,true);
+    const modbus_address_block_t *block=use_bank?NULL:Modbus_Address_Index_Find(ctx->index,MODBUS_TABLE_HOLD_REGISTER,start_addr,length);
+
+    bool ret=true;
+    if(use_bank)
+    {
+        ret=Modbus_Register_Bank_Write_Registers(ctx->bank,MODBUS_TABLE_HOLD_REGISTER,start_addr,data,length);
+    }
+    else if(block!=NULL)
+    {
+        ret=Modbus_Address_Block_Write_Registers(block,start_addr,data,length);
+    }
+    else if(ctx->write_hold_registers!=NULL)
+    {
+        uint16_t registers[MODBUS_MAX_WRITE_REGISTERS];
+        Modbus_Unpack_Registers(registers,data,length);
+        ret=ctx->write_hold_registers(start_addr,registers,length);
+    }
+    else
+    {
+        for(size_t i=0; i<length; i++)
+        {
+            ctx->write_hold_register(start_addr+i,Modbus_ReadUint16_From_2Bytes(&data[2*i]));
         }
+    }
 
+    return ret;
+}
+
+/*
+从机写保持寄存器(0x06/0x10),优先使用批量回调,并调用write_begin/write_commit。data:数据(高字节在前)
+*/
+static modbus_exception_t Modbus_Slave_Write_Registers(modbus_slave_context_t *ctx,uint8_t function_code,size_t start_addr,size_t length,const uint8_t *data)
+{
+    modbus_exception_t exception=Modbus_Slave_Check_Write_Registers(ctx,start_addr,length);
+    if(exception!=MODBUS_EXCEPTION_NONE)
+    {
+        return exception;
     }
-    break;
 
-    case 0x02:
+    if(ctx->write_begin!=NULL && !ctx->write_begin(function_code,start_addr,length))
+    {
+        return MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
+
+    bool ret=Modbus_Slave_Store_Registers(ctx,start_addr,length,data);
+
+    if(ctx->write_commit!=NULL)
     {
-        //读输入线圈
+        ret=ctx->write_commit(ret) && ret;
+    }
+
+    return ret?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+}
 
-        if(input_data[0]!=ctx->slave_addr)
+/*
+从机屏蔽写保持寄存器(0x16)。设置了mask_write_hold_register时由其原子地完成,否则读取当前值后再写入。
+两种方式均在write_begin/write_commit之间进行,读取与写入之间不会被其它写请求打断。
+*/
+static modbus_exception_t Modbus_Slave_Mask_Write_Register(modbus_slave_context_t *ctx,size_t addr,uint16_t and_mask,uint16_t or_mask)
+{
+    if(ctx->mask_write_hold_register==NULL)
+    {
+        modbus_exception_t exception=Modbus_Slave_Check_Write_Registers(ctx,addr,1);
+        if(exception!=MODBUS_EXCEPTION_NONE)
         {
-            //非本从机
-            break;
+            return exception;
         }
+    }
 
-        if(input_data!=buff)
+    if(ctx->write_begin!=NULL && !ctx->write_begin(0x16,addr,1))
+    {
+        return MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+    }
+
+    modbus_exception_t exception=MODBUS_EXCEPTION_NONE;
+    bool ret=true;
+    if(ctx->mask_write_hold_register!=NULL)
+    {
+        ret=ctx->mask_write_hold_register(addr,and_mask,or_mask);
+    }
+    else
+    {
+        uint8_t data[2];
+        exception=Modbus_Slave_Read_Registers(ctx,0x03,addr,1,data);
+        if(exception==MODBUS_EXCEPTION_NONE)
+        {
+            uint16_t value=Modbus_ReadUint16_From_2Bytes(data);
+            Modbus_WriteUint16_To_2Bytes(data,(value&and_mask)|(or_mask&(~and_mask)));
+            ret=Modbus_Slave_Store_Registers(ctx,addr,1,data);
+        }
+        else
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            ret=false;
         }
+    }
+
+    if(ctx->write_commit!=NULL)
+    {
+        ret=ctx->write_commit(ret) && ret;
+    }
+
+    if(exception!=MODBUS_EXCEPTION_NONE)
+    {
+        return exception;
+    }
 
+    return ret?MODBUS_EXCEPTION_NONE:MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+}
+
+/*
+从机输出回应。回应的头部(从机地址开始,header_length字节)位于buff中的offset处,数据部分为payload(为NULL时位于buff中头部之后)。
+RTU在末尾附加CRC,TCP在buff开头(offset之前)填写MBAP报文头且不计算CRC。
+设置了output_iov时,头部、数据部分及CRC分段输出,不拼接整帧。
+*/
+static bool Modbus_Slave_Output(modbus_slave_context_t *ctx,uint8_t *buff,size_t buff_length,modbus_framing_t framing,uint16_t transaction_id,size_t header_length,const uint8_t *payload,size_t payload_length)
+{
+    size_t offset=0;
+    if(framing==MODBUS_FRAMING_TCP)
+    {
+        offset=MODBUS_TCP_MBAP_LENGTH-1;
+        Modbus_TCP_Write_MBAP(buff,transaction_id,header_length+payload_length);
+    }
+    header_length+=offset;
+
+    if(payload==NULL)
+    {
+        payload=&buff[header_length];
+    }
 
-        if(ctx->read_IX!=NULL)
+    if(ctx->output_iov!=NULL && framing==MODBUS_FRAMING_TCP)
+    {
+        modbus_iovec_t iov[2];
+        size_t iov_count=0;
+        iov[iov_count].base=buff;
+        iov[iov_count].length=header_length;
+        iov_count++;
+        if(payload_length>0)
         {
-            uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t length=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-            uint8_t byte_count=length/8+((length%8!=0)?1:0);
-            buff[2]=byte_count;
+            iov[iov_count].base=payload;
+            iov[iov_count].length=payload_length;
+            iov_count++;
+        }
+        ctx->output_iov(iov,iov_count);
+        return true;
+    }
 
-            output_length=5+byte_count;
+    if(ctx->output_iov!=NULL)
+    {
+        modbus_crc_state_t crc;
+        uint8_t crc_bytes[2];
+        modbus_iovec_t iov[3];
+        size_t iov_count=0;
+        Modbus_CRC_Init(&crc);
+        iov[iov_count].base=buff;
+        iov[iov_count].length=header_length;
+        Modbus_CRC_Update(&crc,buff,header_length);
+        iov_count++;
+        if(payload_length>0)
+        {
+            iov[iov_count].base=payload;
+            iov[iov_count].length=payload_length;
+            Modbus_CRC_Update(&crc,payload,payload_length);
+            iov_count++;
+        }
+        crc_bytes[0]=(Modbus_CRC_Final(&crc)&0xff);
+        crc_bytes[1]=(Modbus_CRC_Final(&crc)>>8);
+        iov[iov_count].base=crc_bytes;
+        iov[iov_count].length=sizeof(crc_bytes);
+        iov_count++;
+        ctx->output_iov(iov,iov_count);
+        return true;
+    }
 
-            if(output_length>buff_length)
-            {
-                break;
-            }
+    size_t output_length=header_length+payload_length+((framing==MODBUS_FRAMING_TCP)?0:2);
+    if(output_length>buff_length)
+    {
+        return false;
+    }
 
-            for(size_t i=0; i<length; i++)
-            {
-                if(i%8==0)
-                {
-                    buff[3+i/8]=0xff;
-                }
+    if(payload!=&buff[header_length])
+    {
+        memcpy(&buff[header_length],payload,payload_length);
+    }
 
-                if(ctx->read_IX(start_addr+i))
-                {
-                    buff[3+i/8]|=(0x01<<(i%8));
-                }
-                else
-                {
-                    buff[3+i/8]&=(~(0x01<<(i%8)));
-                }
-            }
+    if(framing!=MODBUS_FRAMING_TCP)
+    {
+        Modbus_Payload_Append_CRC(buff,output_length);
+    }
+    if(ctx->output!=NULL)
+    {
+        ctx->output(buff,output_length);
+    }
 
+    return true;
+}
 
+/*
+从分段数据的offset处读取length字节到data
+*/
+static void Modbus_IOV_Read(const modbus_iovec_t *iov,size_t iov_count,size_t offset,uint8_t *data,size_t length)
+{
+    for(size_t i=0; i<iov_count && length>0; i++)
+    {
+        if(offset>=iov[i].length)
+        {
+            offset-=iov[i].length;
+            continue;
+        }
+        size_t n=iov[i].length-offset;
+        if(n>length)
+        {
+            n=length;
         }
+        memcpy(data,&iov[i].base[offset],n);
+        data+=n;
+        length-=n;
+        offset=0;
+    }
+}
 
+/*
+获取分段数据的offset处length字节的连续数据。数据位于同一段时直接返回该段中的指针,仅在跨越分段边界时复制到scratch。
+*/
+static const uint8_t *Modbus_IOV_Pointer(const modbus_iovec_t *iov,size_t iov_count,size_t offset,size_t length,uint8_t *scratch)
+{
+    size_t offset_start=offset;
+    for(size_t i=0; i<iov_count; i++)
+    {
+        if(offset>=iov[i].length)
+        {
+            offset-=iov[i].length;
+            continue;
+        }
+        if(iov[i].length-offset>=length)
+        {
+            return &iov[i].base[offset];
+        }
+        break;
     }
-    break;
-    case 0x03:
+    Modbus_IOV_Read(iov,iov_count,offset_start,scratch,length);
+    return scratch;
+}
+
+/*
+Modbus从机处理一个请求(可分为多段),与帧格式无关。
+iov从从机地址(TCP为单元标识)开始,input_data_length为从机地址及PDU的长度(不含CRC)。
+回应的从机地址及PDU从frame_buff中的offset处开始构造(TCP为MBAP报文头预留6字节),由Modbus_Slave_Output按帧格式输出。
+请求中的参数均在写入buff之前读取,因此buff可与输入数据相同(原地构造回应)。
+请求不能执行时回应异常(功能码|0x80),广播请求只执行写操作且不回应。
+*/
+static bool Modbus_Slave_Process_PDU(modbus_slave_context_t *ctx,const modbus_iovec_t *iov,size_t iov_count,size_t input_data_length,uint8_t *frame_buff,size_t frame_buff_length,modbus_framing_t framing,uint16_t transaction_id)
+{
+    size_t offset=(framing==MODBUS_FRAMING_TCP)?(MODBUS_TCP_MBAP_LENGTH-1):0;
+    if(frame_buff_length<=offset+2)
+    {
+        return false;
+    }
+    uint8_t *buff=&frame_buff[offset];
+    size_t buff_length=frame_buff_length-offset;
+
+    //帧头(从机地址、功能码、地址、数量、字节数,0x17为11字节)可能跨越分段边界,先读取到局部变量
+    uint8_t input_data[11]= {0};
+    Modbus_IOV_Read(iov,iov_count,0,input_data,(input_data_length<sizeof(input_data))?input_data_length:sizeof(input_data));
+
+    //TCP的单元标识0及MODBUS_TCP_UNIT_ID均用于直接访问TCP设备,不是广播
+    bool broadcast=(framing!=MODBUS_FRAMING_TCP && input_data[0]==MODBUS_BROADCAST_ADDRESS);
+    bool tcp_unit=(framing==MODBUS_FRAMING_TCP && (input_data[0]==MODBUS_BROADCAST_ADDRESS || input_data[0]==MODBUS_TCP_UNIT_ID));
+    if(input_data[0]!=ctx->slave_addr && !broadcast && !tcp_unit)
     {
-        //读保持寄存器
-        if(input_data[0]!=ctx->slave_addr)
+        //非本从机
+        return true;
+    }
+    //回应使用请求中的从机地址(TCP的单元标识可为0或MODBUS_TCP_UNIT_ID)
+    uint8_t unit_id=input_data[0];
+
+    uint8_t function_code=input_data[1];
+    modbus_exception_t exception=MODBUS_EXCEPTION_NONE;
+    bool ret=true;
+    //回应的头部长度(不含CRC),为0时不回应
+    size_t header_length=0;
+    const uint8_t *payload=NULL;
+    size_t payload_length=0;
+    //分段输出及TCP时不需要在buff中为CRC预留空间
+    size_t crc_length=(ctx->output_iov!=NULL || framing==MODBUS_FRAMING_TCP)?0:2;
+
+    switch(function_code)
+    {
+    case 0x01:
+    case 0x02:
+    {
+        //读取线圈(0x01)或输入线圈(0x02)
+        if(broadcast)
         {
-            //非本从机
+            //广播地址不能读取
             break;
         }
 
-        if(input_data!=buff)
+        if(input_data_length<6)
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
         }
 
+        uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&input_data[2]);
+        uint16_t length=Modbus_ReadUint16_From_2Bytes(&input_data[4]);
+        if(length==0 || length > MODBUS_MAX_READ_BITS)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
+        }
+        if((size_t)start_addr+length>0x10000)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+            break;
+        }
+        uint8_t byte_count=length/8+((length%8!=0)?1:0);
 
-        if(ctx->read_hold_register!=NULL)
+        if(ctx->output_iov!=NULL)
         {
-            uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t length=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-            if(length >127)
+            //分段输出时,按字节对齐的数据直接从寄存器存储输出
+            modbus_table_t table=(function_code==0x01)?MODBUS_TABLE_OX:MODBUS_TABLE_IX;
+            if(Modbus_Slave_Use_Bank(ctx,table,start_addr,length,false))
             {
-                break;
+                payload=Modbus_Register_Bank_Table_Bits_Pointer(&ctx->bank->tables[table],start_addr,length);
             }
-            uint8_t byte_count=length*2;
-            buff[2]=byte_count;
-
-            output_length=5+byte_count;
+        }
 
-            if(output_length>buff_length)
+        if(payload==NULL)
+        {
+            if(3+(size_t)byte_count+crc_length>buff_length)
             {
+                //缓冲不足
+                exception=MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+                ret=false;
                 break;
             }
 
-            for(size_t i=0; i<length; i++)
+            exception=Modbus_Slave_Read_Bits(ctx,function_code,start_addr,length,&buff[3]);
+            if(exception!=MODBUS_EXCEPTION_NONE)
             {
-                uint16_t dat=ctx->read_hold_register(start_addr+i);
-                Modbus_WriteUint16_To_2Bytes(&buff[3+2*i],dat);
+                break;
             }
+        }
 
+        buff[0]=unit_id;
+        buff[1]=function_code;
+        buff[2]=byte_count;
+        header_length=3;
+        payload_length=byte_count;
 
-        }
     }
     break;
 
+    case 0x03:
     case 0x04:
     {
-        //读输入寄存器
-        if(input_data[0]!=ctx->slave_addr)
+        //读保持寄存器(0x03)或输入寄存器(0x04)
+        if(broadcast)
         {
-            //非本从机
+            //广播地址不能读取
             break;
         }
 
-        if(input_data!=buff)
+        if(input_data_length<6)
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
         }
 
-
-        if(ctx->read_input_register!=NULL)
+        uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&input_data[2]);
+        uint16_t length=Modbus_ReadUint16_From_2Bytes(&input_data[4]);
+        if(length==0 || length > MODBUS_MAX_READ_REGISTERS)
         {
-            uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t length=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-            if(length >127)
-            {
-                break;
-            }
-            uint8_t byte_count=length*2;
-            buff[2]=byte_count;
-
-            output_length=5+byte_count;
-
-            if(output_length>buff_length)
-            {
-                break;
-            }
-
-            for(size_t i=0; i<length; i++)
-            {
-                uint16_t dat=ctx->read_input_register(start_addr+i);
-                Modbus_WriteUint16_To_2Bytes(&buff[3+2*i],dat);
-            }
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
+        }
+        if((size_t)start_addr+length>0x10000)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+            break;
+        }
+        uint8_t byte_count=length*2;
 
+        if(3+(size_t)byte_count+crc_length>buff_length)
+        {
+            //缓冲不足
+            exception=MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+            ret=false;
+            break;
+        }
 
+        exception=Modbus_Slave_Read_Registers(ctx,function_code,start_addr,length,&buff[3]);
+        if(exception!=MODBUS_EXCEPTION_NONE)
+        {
+            break;
         }
 
+        buff[0]=unit_id;
+        buff[1]=function_code;
+        buff[2]=byte_count;
+        header_length=3;
+        payload_length=byte_count;
+
     }
     break;
 
     case 0x05:
+    case 0x06:
     {
-        //强制设置单个输出线圈
-        if(input_data[0]!=ctx->slave_addr)
+        //强制设置单个输出线圈(0x05)或设置单个保持寄存器(0x06)
+        if(input_data_length<6)
         {
-            //非本从机
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
             break;
         }
 
-        if(input_data!=buff)
+        uint16_t addr=Modbus_ReadUint16_From_2Bytes(&input_data[2]);
+        uint16_t data=Modbus_ReadUint16_From_2Bytes(&input_data[4]);
+
+        if(6+crc_length>buff_length)
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            //缓冲不足
+            exception=MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+            ret=false;
+            break;
         }
 
-        output_length=input_data_length;
+        if(function_code==0x05)
+        {
+            if(data!=0xFF00 && data!=0x0000)
+            {
+                exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+                break;
+            }
+            uint8_t bit=(data==0xFF00)?0x01:0x00;
+            exception=Modbus_Slave_Write_Bits(ctx,function_code,addr,1,&bit);
+        }
+        else
+        {
+            exception=Modbus_Slave_Write_Registers(ctx,function_code,addr,1,&input_data[4]);
+        }
 
-        if(ctx->write_OX!=NULL)
+        if(exception==MODBUS_EXCEPTION_NONE)
         {
-            uint16_t addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t data=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-            ctx->write_OX(addr,data);
+            //回应与请求相同
+            memcpy(buff,input_data,6);
+            header_length=6;
         }
 
     }
     break;
 
-    case 0x06:
+    case 0x0F:
+    case 0x10:
     {
-        //设置单个保持寄存器
-        if(input_data[0]!=ctx->slave_addr)
+        //设置多个输出线圈(0x0F)或多个保持寄存器(0x10)
+        if(input_data_length<7)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
+        }
+
+        uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&input_data[2]);
+        uint16_t length=Modbus_ReadUint16_From_2Bytes(&input_data[4]);
+        size_t byte_count=(function_code==0x0F)?(length/8+((length%8!=0)?1:0)):(length*2);
+        size_t max_length=(function_code==0x0F)?MODBUS_MAX_WRITE_BITS:MODBUS_MAX_WRITE_REGISTERS;
+        if(length==0 || length > max_length || input_data[6]!=byte_count || input_data_length<7+byte_count)
         {
-            //非本从机
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
+        }
+        if((size_t)start_addr+length>0x10000)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
             break;
         }
 
-        if(input_data!=buff)
+        if(6+crc_length>buff_length)
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            //缓冲不足
+            exception=MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+            ret=false;
+            break;
         }
 
-        output_length=input_data_length;
+        //数据部分跨越分段边界时才需要复制
+        uint8_t scratch[MODBUS_MAX_WRITE_REGISTERS*2];
+        const uint8_t *data=Modbus_IOV_Pointer(iov,iov_count,7,byte_count,scratch);
 
-        if(ctx->write_hold_register!=NULL)
+        if(function_code==0x0F)
         {
-            uint16_t addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t data=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-            ctx->write_hold_register(addr,data);
+            exception=Modbus_Slave_Write_Bits(ctx,function_code,start_addr,length,data);
+        }
+        else
+        {
+            exception=Modbus_Slave_Write_Registers(ctx,function_code,start_addr,length,data);
+        }
+
+        if(exception==MODBUS_EXCEPTION_NONE)
+        {
+            //回应为请求的前6字节
+            memcpy(buff,input_data,6);
+            header_length=6;
         }
 
     }
     break;
 
-    case 0x0F:
+    case 0x16:
     {
-        //设置多个输出线圈
-        if(input_data[0]!=ctx->slave_addr && input_data[0]==0)
+        //屏蔽写保持寄存器
+        if(input_data_length<8)
         {
-            //非本从机或广播地址
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
             break;
         }
 
-        if(input_data!=buff)
-        {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
-        }
-
-        buff[0]=ctx->slave_addr;
-        output_length=8;
+        uint16_t addr=Modbus_ReadUint16_From_2Bytes(&input_data[2]);
+        uint16_t and_mask=Modbus_ReadUint16_From_2Bytes(&input_data[4]);
+        uint16_t or_mask=Modbus_ReadUint16_From_2Bytes(&input_data[6]);
 
-        if(ctx->write_OX!=NULL)
+        if(8+crc_length>buff_length)
         {
-            uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t length=Modbus_ReadUint16_From_2Bytes(&buff[4]);
-
-            for(size_t i=0; i<length; i++)
-            {
-                if((buff[7+i/8]&(0x01<<(i%8)))!=0)
-                {
-                    ctx->write_OX(start_addr+i,0xFF00);
-                }
-                else
-                {
-                    ctx->write_OX(start_addr+i,0x0000);
-                }
-            }
+            //缓冲不足
+            exception=MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+            ret=false;
+            break;
+        }
 
+        exception=Modbus_Slave_Mask_Write_Register(ctx,addr,and_mask,or_mask);
 
+        if(exception==MODBUS_EXCEPTION_NONE)
+        {
+            //回应与请求相同
+            memcpy(buff,input_data,8);
+            header_length=8;
         }
+
     }
     break;
-    case 0x10:
+
+    case 0x17:
     {
-        //设置多个保持寄存器
-        if(input_data[0]!=ctx->slave_addr && input_data[0]==0)
+        //写并读多个保持寄存器(先写入再读取)
+        if(broadcast)
         {
-            //非本从机或广播地址
+            //广播地址不能读取
             break;
         }
 
-        if(input_data!=buff)
+        if(input_data_length<11)
         {
-            //将下发的指令复制到buff
-            memcpy(buff,input_data,input_data_length);
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
         }
 
-        buff[0]=ctx->slave_addr;
-        output_length=8;
+        uint16_t read_addr=Modbus_ReadUint16_From_2Bytes(&input_data[2]);
+        uint16_t read_length=Modbus_ReadUint16_From_2Bytes(&input_data[4]);
+        uint16_t write_addr=Modbus_ReadUint16_From_2Bytes(&input_data[6]);
+        uint16_t write_length=Modbus_ReadUint16_From_2Bytes(&input_data[8]);
+        size_t write_byte_count=write_length*2;
+        if(read_length==0 || read_length > MODBUS_MAX_WR_READ_REGISTERS || write_length==0 || write_length > MODBUS_MAX_WR_WRITE_REGISTERS || input_data[10]!=write_byte_count || input_data_length<11+write_byte_count)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+            break;
+        }
+        if((size_t)read_addr+read_length>0x10000 || (size_t)write_addr+write_length>0x10000)
+        {
+            exception=MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+            break;
+        }
+        uint8_t byte_count=read_length*2;
 
-        if(ctx->write_hold_register!=NULL)
+        if(3+(size_t)byte_count+crc_length>buff_length)
         {
-            uint16_t start_addr=Modbus_ReadUint16_From_2Bytes(&buff[2]);
-            uint16_t length=Modbus_ReadUint16_From_2Bytes(&buff[4]);
+            //缓冲不足
+            exception=MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE;
+            ret=false;
+            break;
+        }
 
-            for(size_t i=0; i<length; i++)
-            {
-                ctx->write_hold_register(start_addr+i,Modbus_ReadUint16_From_2Bytes(&buff[7+2*i]));
-            }
+        //写入数据在读取之前使用完毕,buff与输入数据相同时也不会被覆盖
+        uint8_t scratch[MODBUS_MAX_WR_WRITE_REGISTERS*2];
+        const uint8_t *data=Modbus_IOV_Pointer(iov,iov_count,11,write_byte_count,scratch);
+        exception=Modbus_Slave_Write_Registers(ctx,function_code,write_addr,write_length,data);
+        if(exception!=MODBUS_EXCEPTION_NONE)
+        {
+            break;
+        }
 
+        exception=Modbus_Slave_Read_Registers(ctx,0x03,read_addr,read_length,&buff[3]);
+        if(exception!=MODBUS_EXCEPTION_NONE)
+        {
+            break;
         }
 
+        buff[0]=unit_id;
+        buff[1]=function_code;
+        buff[2]=byte_count;
+        header_length=3;
+        payload_length=byte_count;
 
     }
     break;
 
     default:
+        exception=MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
         break;
     }
 
-    if(output_length>2)
-    {
-        if(buff_length>=output_length)
-        {
-            Modbus_Payload_Append_CRC(buff,output_length);
-            if(ctx->output!=NULL)
-            {
-                ctx->output(buff,output_length);
-            }
-        }
-        else
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
-bool Modbus_Master_Read_OX(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
-{
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
-    {
-        //参数不正确
-        return false;
-    }
-
-    if(number > MODBUS_MAX_READ_BITS)
+    if(broadcast)
     {
-        return false;
-    }
-
-    size_t output_length=8;
-    size_t input_length=5+number/8+((number%8==0)?0:1);
-
-    if(output_length>buff_length || input_length> buff_length)
-    {
-        return false;
+        //广播请求不回应
+        return ret;
     }
 
+    if(exception!=MODBUS_EXCEPTION_NONE)
     {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x01;//查询输出状态
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
-        Modbus_Payload_Append_CRC(buff,output_length);
+        //异常回应:从机地址+(功能码|0x80)+异常码
+        buff[0]=unit_id;
+        buff[1]=function_code|0x80;
+        buff[2]=exception;
+        return Modbus_Slave_Output(ctx,frame_buff,frame_buff_length,framing,transaction_id,3,NULL,0) && ret;
     }
 
-    ctx->output(buff,output_length);
-
-    if(input_length== ctx->request_reply(buff,input_length))
+    if(header_length>0)
     {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            for(size_t i=0; i<number; i++)
-            {
-                data[i]=((buff[3+i/8]&(0x01<<(i%8)))!=0);
-            }
-
-            return true;
-        }
+        return Modbus_Slave_Output(ctx,frame_buff,frame_buff_length,framing,transaction_id,header_length,payload,payload_length);
     }
 
-
-
-    return false;
-
+    return ret;
 }
 
-bool Modbus_Master_Read_IX(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
-{
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
-    {
-        //参数不正确
-        return false;
-    }
+/*
+Modbus从机解析输入。ctx：上下文指针,input_data:输入数据指针,input_data_length:输入数据长度,buff:缓冲(存放临时数据),buff_length:缓冲长度
+*/
 
-    if(number > MODBUS_MAX_READ_BITS)
+bool Modbus_Slave_Parse_Input(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,uint8_t *buff,size_t buff_length)
+{
+    if(ctx==NULL  || input_data ==NULL || input_data_length <=2 || buff==NULL || buff_length <=2)
     {
         return false;
     }
 
-    size_t output_length=8;
-    size_t input_length=5+number/8+((number%8==0)?0:1);
-
-    if(output_length>buff_length || input_length> buff_length)
+    if(!Modbus_Payload_Check_CRC(input_data,input_data_length))
     {
         return false;
     }
 
-    {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x02;//查询输入状态
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
-        Modbus_Payload_Append_CRC(buff,output_length);
-    }
-
-    ctx->output(buff,output_length);
-
-    if(input_length== ctx->request_reply(buff,input_length))
-    {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            for(size_t i=0; i<number; i++)
-            {
-                data[i]=((buff[3+i/8]&(0x01<<(i%8)))!=0);
-            }
-
-            return true;
-        }
-    }
-
-
-
-    return false;
-
+    modbus_iovec_t iov= {input_data,input_data_length};
+    return Modbus_Slave_Process_PDU(ctx,&iov,1,input_data_length-2,buff,buff_length,MODBUS_FRAMING_RTU,0);
 }
 
-bool Modbus_Master_Read_Hold_Register(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
+/*
+Modbus从机解析输入(使用接收时已计算的CRC状态)。crc:整帧(包含CRC)的CRC计算状态
+*/
+bool Modbus_Slave_Parse_Input_With_CRC(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,const modbus_crc_state_t *crc,uint8_t *buff,size_t buff_length)
 {
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
+    if(ctx==NULL  || input_data ==NULL || input_data_length <=2 || crc==NULL || buff==NULL || buff_length <=2)
     {
-        //参数不正确
         return false;
     }
 
-    if(number > MODBUS_MAX_READ_REGISTERS)
+    if(crc->length!=input_data_length || !Modbus_CRC_Check(crc))
     {
         return false;
     }
 
-    size_t output_length=8;
-    size_t input_length=5+number*2;
+    modbus_iovec_t iov= {input_data,input_data_length};
+    return Modbus_Slave_Process_PDU(ctx,&iov,1,input_data_length-2,buff,buff_length,MODBUS_FRAMING_RTU,0);
+}
 
-    if(output_length>buff_length || input_length> buff_length)
+/*
+Modbus从机解析分段输入(如跨越环形缓冲末尾的一帧)。iov:分段数据,iov_count:分段数量
+*/
+bool Modbus_Slave_Parse_Input_IOV(modbus_slave_context_t *ctx,const modbus_iovec_t *iov,size_t iov_count,uint8_t *buff,size_t buff_length)
+{
+    if(ctx==NULL  || iov ==NULL || iov_count ==0 || buff==NULL || buff_length <=2)
     {
         return false;
     }
 
+    if(!Modbus_Payload_Check_CRC_IOV(iov,iov_count))
     {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x03;//查询保持寄存器
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
-        Modbus_Payload_Append_CRC(buff,output_length);
+        return false;
     }
 
-    ctx->output(buff,output_length);
-
-    if(input_length== ctx->request_reply(buff,input_length))
+    size_t input_data_length=0;
+    for(size_t i=0; i<iov_count; i++)
     {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            for(size_t i=0; i<number; i++)
-            {
-                data[i]=Modbus_ReadUint16_From_2Bytes(&buff[3+2*i]);
-            }
-
-            return true;
-        }
+        input_data_length+=iov[i].length;
     }
 
-
-
-    return false;
-
+    return Modbus_Slave_Process_PDU(ctx,iov,iov_count,input_data_length-2,buff,buff_length,MODBUS_FRAMING_RTU,0);
 }
 
-bool Modbus_Master_Read_Input_Register(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
+/*
+Modbus从机解析TCP输入。input_data:一帧完整的MBAP帧(不含CRC)
+*/
+bool Modbus_Slave_Parse_Input_TCP(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,uint8_t *buff,size_t buff_length)
 {
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
-    {
-        //参数不正确
-        return false;
-    }
-
-    if(number > MODBUS_MAX_READ_REGISTERS)
+    if(ctx==NULL  || input_data ==NULL || buff==NULL || buff_length <MODBUS_TCP_MBAP_LENGTH+2)
     {
         return false;
     }
 
-    size_t output_length=8;
-    size_t input_length=5+number*2;
-
-    if(output_length>buff_length || input_length> buff_length)
+    int length=Modbus_TCP_Predict_Length(input_data,input_data_length);
+    if(length<=0 || (size_t)length!=input_data_length)
     {
         return false;
     }
 
-    {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x04;//查询输入寄存器
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
-        Modbus_Payload_Append_CRC(buff,output_length);
-    }
+    //从单元标识开始与RTU相同(没有CRC)
+    modbus_iovec_t iov= {&input_data[MODBUS_TCP_MBAP_LENGTH-1],input_data_length-(MODBUS_TCP_MBAP_LENGTH-1)};
+    return Modbus_Slave_Process_PDU(ctx,&iov,1,iov.length,buff,buff_length,MODBUS_FRAMING_TCP,Modbus_ReadUint16_From_2Bytes(&input_data[0]));
+}
 
-    ctx->output(buff,output_length);
+/*
+主机请求引擎的输出函数(阻塞模式),usr为主机上下文
+*/
+static void Modbus_Master_Output(modbus_master_engine_t *engine,uint8_t *data,size_t data_length)
+{
+    modbus_master_context_t *ctx=(modbus_master_context_t *)engine->usr;
+    ctx->transaction_id=engine->transaction_id;
+    ctx->output(data,data_length);
+}
 
-    if(input_length== ctx->request_reply(buff,input_length))
+/*
+主机接收length字节的回应。request_reply(或request_reply_with_crc)每次可只返回一部分,返回0(超时)时失败。
+*/
+static bool Modbus_Master_Receive(modbus_master_context_t *ctx,uint8_t *data,size_t length,modbus_crc_state_t *crc)
+{
+    size_t received=0;
+    while(received<length)
     {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
+        size_t remaining=length-received;
+        size_t ret=0;
+        if(ctx->request_reply_with_crc!=NULL)
         {
-            for(size_t i=0; i<number; i++)
-            {
-                data[i]=Modbus_ReadUint16_From_2Bytes(&buff[3+2*i]);
-            }
-
-            return true;
+            ret=ctx->request_reply_with_crc(&data[received],remaining,crc);
         }
+        else
+        {
+            ret=ctx->request_reply(&data[received],remaining);
+        }
+        if(ret==0 || ret>remaining)
+        {
+            return false;
+        }
+        received+=ret;
     }
 
-
-
-    return false;
-
+    return true;
 }
 
 /*
-单个线圈
+阻塞等待回应超时:未设置策略时失败,否则交给请求引擎按策略重新发送或结束请求
 */
-static bool Modbus_Master_Write_OX_05(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
+static bool Modbus_Master_Timeout(modbus_master_engine_t *engine)
 {
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
-    {
-        //参数不正确
-        return false;
-    }
-
-    size_t output_length=8;
-    size_t input_length=8;
-
-    if(output_length>buff_length || input_length> buff_length)
+    if(engine->policy==NULL || engine->timeout==0)
     {
         return false;
     }
 
+    uint32_t now=engine->policy->get_time(engine->policy);
+    if((int32_t)(now-engine->deadline)<0)
     {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x05;//强制单个线圈
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],data[0]?(0xFF00):(0x0000));
-        buff[6]=number/8+((number%8!=0)?1:0);
-
-
-        Modbus_Payload_Append_CRC(buff,output_length);
-    }
-
-    ctx->output(buff,output_length);
-
-    if(input_length== ctx->request_reply(buff,input_length))
-    {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            return true;
-        }
+        //request_reply已等待超时时间
+        now=engine->deadline;
     }
+    Modbus_Master_Engine_Tick(engine,now);
 
-
-
-    return false;
+    return true;
 }
 
-bool Modbus_Master_Write_OX(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
+/*
+主机阻塞执行一个请求:通过请求引擎发送请求,然后调用request_reply(或request_reply_with_crc)等待从机回应。
+先接收3字节帧头(TCP为6字节MBAP报文头),由帧头预测回应的实际长度后再接收剩余部分,异常回应不需要等待超时。
+设置了策略时,超时或回应错误由请求引擎按策略重新发送,直到请求完成。
+*/
+static bool Modbus_Master_Execute(modbus_master_context_t *ctx,modbus_master_request_t *request,uint8_t *buff,size_t buff_length)
 {
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
-    {
-        //参数不正确
-        return false;
-    }
-
-    if(number > MODBUS_MAX_WRITE_BITS)
+    modbus_master_engine_t engine;
+    if(!Modbus_Master_Engine_Init(&engine,buff,buff_length,Modbus_Master_Output,ctx))
     {
         return false;
     }
 
-    if(number==1)
+    modbus_master_policy_t *policy=ctx->policy;
+    if(policy!=NULL && policy->get_time!=NULL)
     {
-        return Modbus_Master_Write_OX_05(ctx,start_addr,data,number,buff,buff_length);
+        engine.policy=policy;
     }
-
-    size_t output_length=9+number/8+((number%8!=0)?1:0);
-    size_t input_length=8;
-
-    if(output_length>buff_length || input_length> buff_length)
+    engine.framing=ctx->framing;
+    engine.transaction_id=ctx->transaction_id;
+    size_t header_length=(ctx->framing==MODBUS_FRAMING_TCP)?(MODBUS_TCP_MBAP_LENGTH-1):3;
+
+    request->slave_addr=ctx->slave_addr;
+    request->timeout=0;
+    request->complete=NULL;
+    request->usr=NULL;
+    if(!Modbus_Master_Engine_Submit(&engine,request,(engine.policy!=NULL)?policy->get_time(policy):0))
     {
         return false;
     }
 
+    uint8_t *input=NULL;
+    while((input=Modbus_Master_Engine_Rx_Buffer(&engine,NULL))!=NULL)
     {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x0F;//强制多个线圈
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
-        buff[6]=number/8+((number%8!=0)?1:0);
-
-        for(size_t i=0; i<number; i++)
+        //直接接收到引擎的缓冲中
+        modbus_crc_state_t crc;
+        Modbus_CRC_Init(&crc);
+        if(!Modbus_Master_Receive(ctx,input,header_length,&crc))
         {
-            if(i%8==0)
-            {
-                buff[7+i/8]=0xFF;
-            }
-            if(data[i])
+            if(!Modbus_Master_Timeout(&engine))
             {
-                buff[7+i/8]|=(0x01<<(i%8));
+                return false;
             }
-            else
+            continue;
+        }
+
+        uint32_t now=(engine.policy!=NULL)?policy->get_time(policy):0;
+        int input_length=(ctx->framing==MODBUS_FRAMING_TCP)?Modbus_TCP_Predict_Length(input,header_length):Modbus_RTU_Predict_Response_Length(input,header_length);
+        if(input_length<=(int)header_length || (size_t)input_length>buff_length)
+        {
+            //由请求引擎按回应错误结束请求(或按策略重新发送)
+            Modbus_Master_Engine_Feed(&engine,input,header_length,now);
+            continue;
+        }
+
+        if(!Modbus_Master_Receive(ctx,&input[header_length],input_length-header_length,&crc))
+        {
+            if(!Modbus_Master_Timeout(&engine))
             {
-                buff[7+i/8]&=(~(0x01<<(i%8)));
+                return false;
             }
+            continue;
         }
 
-        Modbus_Payload_Append_CRC(buff,output_length);
+        now=(engine.policy!=NULL)?policy->get_time(policy):0;
+        if(ctx->request_reply_with_crc!=NULL && ctx->framing!=MODBUS_FRAMING_TCP)
+        {
+            Modbus_Master_Engine_Feed_With_CRC(&engine,input,input_length,&crc,now);
+        }
+        else
+        {
+            Modbus_Master_Engine_Feed(&engine,input,input_length,now);
+        }
     }
 
-    ctx->output(buff,output_length);
+    return request->status==MODBUS_MASTER_STATUS_OK;
+}
 
-    if(input_length== ctx->request_reply(buff,input_length))
+/*
+主机阻塞读取/写入线圈及输入点
+*/
+static bool Modbus_Master_Execute_Bits(modbus_master_context_t *ctx,uint8_t function_code,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||(ctx->request_reply ==NULL && ctx->request_reply_with_crc ==NULL))
     {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            return true;
-        }
+        //参数不正确
+        return false;
     }
 
+    modbus_master_request_t request;
+    memset(&request,0,sizeof(request));
+    request.function_code=function_code;
+    request.start_addr=start_addr;
+    request.number=number;
+    request.bits=data;
 
-
-    return false;
+    return Modbus_Master_Execute(ctx,&request,buff,buff_length);
 }
 
-
-static bool Modbus_Master_Write_Hold_Register_06(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
+/*
+主机阻塞读取/写入线圈及输入点(按位打包)
+*/
+static bool Modbus_Master_Execute_Packed_Bits(modbus_master_context_t *ctx,uint8_t function_code,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length)
 {
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
+    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||(ctx->request_reply ==NULL && ctx->request_reply_with_crc ==NULL))
     {
         //参数不正确
         return false;
     }
 
-    size_t output_length=8;
-    size_t input_length=8;
+    modbus_master_request_t request;
+    memset(&request,0,sizeof(request));
+    request.function_code=function_code;
+    request.start_addr=start_addr;
+    request.number=number;
+    request.packed_bits=data;
+
+    return Modbus_Master_Execute(ctx,&request,buff,buff_length);
+}
 
-    if(output_length>buff_length || input_length> buff_length)
+/*
+主机阻塞读取/写入寄存器
+*/
+static bool Modbus_Master_Execute_Registers(modbus_master_context_t *ctx,uint8_t function_code,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||(ctx->request_reply ==NULL && ctx->request_reply_with_crc ==NULL))
     {
+        //参数不正确
         return false;
     }
 
-    {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x06;//强制单个保持寄存器
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],data[0]);
-        Modbus_Payload_Append_CRC(buff,output_length);
-    }
+    modbus_master_request_t request;
+    memset(&request,0,sizeof(request));
+    request.function_code=function_code;
+    request.start_addr=start_addr;
+    request.number=number;
+    request.registers=data;
 
-    ctx->output(buff,output_length);
+    return Modbus_Master_Execute(ctx,&request,buff,buff_length);
+}
 
-    if(input_length== ctx->request_reply(buff,input_length))
-    {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            return true;
-        }
-    }
+bool Modbus_Master_Read_OX(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //查询输出状态
+    return Modbus_Master_Execute_Bits(ctx,0x01,start_addr,data,number,buff,buff_length);
+}
+
+bool Modbus_Master_Read_IX(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //查询输入状态
+    return Modbus_Master_Execute_Bits(ctx,0x02,start_addr,data,number,buff,buff_length);
+}
 
+bool Modbus_Master_Read_Hold_Register(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //查询保持寄存器
+    return Modbus_Master_Execute_Registers(ctx,0x03,start_addr,data,number,buff,buff_length);
+}
 
+bool Modbus_Master_Read_Input_Register(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //查询输入寄存器
+    return Modbus_Master_Execute_Registers(ctx,0x04,start_addr,data,number,buff,buff_length);
+}
 
-    return false;
+bool Modbus_Master_Write_OX(modbus_master_context_t *ctx,uint16_t start_addr,bool *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //强制单个线圈(0x05)或多个线圈(0x0F)
+    return Modbus_Master_Execute_Bits(ctx,(number==1)?0x05:0x0F,start_addr,data,number,buff,buff_length);
 }
 
 bool Modbus_Master_Write_Hold_Register(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length)
 {
-    if(ctx==NULL || data ==NULL || buff == NULL || number == 0 || buff_length == 0 || ctx->output ==NULL ||ctx->request_reply ==NULL)
-    {
-        //参数不正确
-        return false;
-    }
+    //强制单个保持寄存器(0x06)或多个保持寄存器(0x10)
+    return Modbus_Master_Execute_Registers(ctx,(number==1)?0x06:0x10,start_addr,data,number,buff,buff_length);
+}
 
-    if(number > MODBUS_MAX_WRITE_REGISTERS)
-    {
-        return false;
-    }
+bool Modbus_Master_Read_OX_Packed(modbus_master_context_t *ctx,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //查询输出状态
+    return Modbus_Master_Execute_Packed_Bits(ctx,0x01,start_addr,data,number,buff,buff_length);
+}
 
-    if(number==1)
-    {
-        return Modbus_Master_Write_Hold_Register_06(ctx,start_addr,data,number,buff,buff_length);
-    }
+bool Modbus_Master_Read_IX_Packed(modbus_master_context_t *ctx,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //查询输入状态
+    return Modbus_Master_Execute_Packed_Bits(ctx,0x02,start_addr,data,number,buff,buff_length);
+}
 
-    size_t output_length=9+number*2;
-    size_t input_length=8;
+bool Modbus_Master_Write_OX_Packed(modbus_master_context_t *ctx,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length)
+{
+    //强制单个线圈(0x05)或多个线圈(0x0F)
+    return Modbus_Master_Execute_Packed_Bits(ctx,(number==1)?0x05:0x0F,start_addr,data,number,buff,buff_length);
+}
 
-    if(output_length>buff_length || input_length> buff_length)
+bool Modbus_Master_Write_Read_Hold_Register(modbus_master_context_t *ctx,uint16_t write_addr,uint16_t *write_data,size_t write_number,uint16_t read_addr,uint16_t *read_data,size_t read_number,uint8_t *buff,size_t buff_length)
+{
+    if(ctx==NULL || write_data==NULL || read_data==NULL || buff == NULL || write_number == 0 || read_number == 0 || buff_length == 0 || ctx->output ==NULL ||(ctx->request_reply ==NULL && ctx->request_reply_with_crc ==NULL))
     {
+        //参数不正确
         return false;
     }
 
-    {
-        //填写参数
-        buff[0]=ctx->slave_addr;
-        buff[1]=0x10;//强制多个线圈
-        Modbus_WriteUint16_To_2Bytes(&buff[2],start_addr);
-        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
-        buff[6]=number*2;
-
-        for(size_t i=0; i<number; i++)
-        {
-            Modbus_WriteUint16_To_2Bytes(&buff[7+i*2],data[i]);
-        }
-
-        Modbus_Payload_Append_CRC(buff,output_length);
-    }
-
-    ctx->output(buff,output_length);
+    //写并读多个保持寄存器(0x17)
+    modbus_master_request_t request;
+    memset(&request,0,sizeof(request));
+    request.function_code=0x17;
+    request.start_addr=read_addr;
+    request.number=read_number;
+    request.registers=read_data;
+    request.write_addr=write_addr;
+    request.write_number=write_number;
+    request.write_registers=write_data;
+
+    return Modbus_Master_Execute(ctx,&request,buff,buff_length);
+}
 
-    if(input_length== ctx->request_reply(buff,input_length))
+bool Modbus_Master_Mask_Write_Hold_Register(modbus_master_context_t *ctx,uint16_t addr,uint16_t and_mask,uint16_t or_mask,uint8_t *buff,size_t buff_length)
+{
+    if(ctx==NULL || buff == NULL || buff_length == 0 || ctx->output ==NULL ||(ctx->request_reply ==NULL && ctx->request_reply_with_crc ==NULL))
     {
-        if(Modbus_Payload_Check_CRC(buff,input_length))
-        {
-            return true;
-        }
+        //参数不正确
+        return false;
     }
 
+    //屏蔽写保持寄存器(0x16)
+    modbus_master_request_t request;
+    memset(&request,0,sizeof(request));
+    request.function_code=0x16;
+    request.start_addr=addr;
+    request.number=1;
+    request.and_mask=and_mask;
+    request.or_mask=or_mask;
 
-
-    return false;
+    return Modbus_Master_Execute(ctx,&request,buff,buff_length);
 }
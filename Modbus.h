@@ -54,6 +54,49 @@ extern "C" {
  */
 #define MODBUS_RTU_MAX_ADU_LENGTH 256
 
+/* Modbus_Messaging_Implementation_Guide_V1_0b.pdf Chapter 3 Section 1.3 Page 5
+ * MBAP Header = Transaction Identifier (2 bytes) + Protocol Identifier (2 bytes) + Length (2 bytes) + Unit Identifier (1 byte)
+ * TCP MODBUS ADU = 253 bytes + MBAP (7 bytes) = 260 bytes
+ */
+#define MODBUS_TCP_MBAP_LENGTH    7
+#define MODBUS_TCP_MAX_ADU_LENGTH 260
+
+/* Modbus_Messaging_Implementation_Guide_V1_0b.pdf Chapter 4 Section 4.1.4 Page 23
+ * On TCP/IP, the MODBUS server is addressed using its IP address; the value 0xFF has to be used as Unit Identifier.
+ */
+#define MODBUS_TCP_UNIT_ID 0xFF
+
+typedef enum
+{
+    MODBUS_FRAMING_RTU=0,/**< RTU:从机地址+PDU+CRC */
+    MODBUS_FRAMING_TCP,/**< TCP:MBAP报文头(事务标识、协议标识、长度、单元标识)+PDU,不计算CRC */
+} modbus_framing_t/**< 帧格式(PDU的编码及解码与帧格式无关) */;
+
+typedef enum
+{
+    MODBUS_EXCEPTION_NONE=0x00,/**< 无异常 */
+    MODBUS_EXCEPTION_ILLEGAL_FUNCTION=0x01,/**< 不支持的功能码(或未设置相应的回调函数及存储) */
+    MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS=0x02,/**< 地址非法(不在寄存器存储或地址块中,或地址块只读) */
+    MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE=0x03,/**< 数据非法(数量超出限制、字节数不符或帧长度不正确) */
+    MODBUS_EXCEPTION_SLAVE_DEVICE_FAILURE=0x04/**< 从机故障(回调函数返回失败或缓冲不足) */
+} modbus_exception_t/**< Modbus异常码,从机不能执行请求时回应功能码|0x80及异常码 */;
+
+/** \brief 从数据帧中读取16位数据(高字节在前)
+ *
+ * \param pos 数据指针
+ * \return 16位数据
+ *
+ */
+uint16_t Modbus_ReadUint16_From_2Bytes(const uint8_t *pos);
+
+/** \brief 向数据帧中写入16位数据(高字节在前)
+ *
+ * \param pos 数据指针
+ * \param dat 16位数据
+ *
+ */
+void Modbus_WriteUint16_To_2Bytes(uint8_t *pos,uint16_t dat);
+
 
 /** \brief 检查一帧数据的crc
  *
@@ -75,6 +118,143 @@ bool Modbus_Payload_Check_CRC(uint8_t *payload,size_t payload_length);
  */
 bool Modbus_Payload_Append_CRC(uint8_t *payload,size_t payload_length);
 
+typedef enum
+{
+    MODBUS_CRC_BACKEND_BITWISE=0,/**< 逐位计算,不需要表 */
+    MODBUS_CRC_BACKEND_TABLE,/**< 256项查表(表在ROM中),默认 */
+    MODBUS_CRC_BACKEND_SLICE4,/**< slice-by-4,需要4KB RAM存放表 */
+    MODBUS_CRC_BACKEND_SLICE8,/**< slice-by-8,需要4KB RAM存放表 */
+    MODBUS_CRC_BACKEND_AUTO,/**< 自动选择当前编译配置下最快的实现 */
+} modbus_crc_backend_t/**< CRC计算实现 */;
+
+/** \brief 选择CRC计算实现。
+ * 所有实现的结果完全一致。选择slice-by-N时会在此函数中初始化表,因此应在初始化阶段(其它Modbus函数被调用前)调用。
+ * 定义MODBUS_CRC_DISABLE_SLICE宏时slice-by-N不可用。
+ * \param backend CRC计算实现
+ * \return 是否调用成功
+ *
+ */
+bool Modbus_CRC_Set_Backend(modbus_crc_backend_t backend);
+
+/** \brief 获取当前CRC计算实现
+ *
+ * \return 当前CRC计算实现(不会返回MODBUS_CRC_BACKEND_AUTO)
+ *
+ */
+modbus_crc_backend_t Modbus_CRC_Get_Backend(void);
+
+/** \brief CRC自检,将所有可用的CRC计算实现与逐位计算结果进行比较
+ *
+ * \return 自检是否通过
+ *
+ */
+bool Modbus_CRC_Self_Test(void);
+
+typedef struct
+{
+    uint16_t crc;/**< 当前CRC值 */
+    size_t length;/**< 已并入的数据长度 */
+} modbus_crc_state_t/**< CRC计算状态,用于边接收边计算CRC */;
+
+typedef struct
+{
+    const uint8_t *base;/**< 数据指针 */
+    size_t length;/**< 数据长度 */
+} modbus_iovec_t/**< 分段数据中的一段 */;
+
+/** \brief 检查分段数据(如跨越环形缓冲末尾的一帧)的crc,不需要先拼接为连续数据
+ *
+ * \param iov 整帧数据(包含CRC)的各段
+ * \param iov_count 分段数量
+ * \return CRC是否通过
+ *
+ */
+bool Modbus_Payload_Check_CRC_IOV(const modbus_iovec_t *iov,size_t iov_count);
+
+/** \brief 初始化CRC计算状态
+ *
+ * \param state CRC计算状态
+ *
+ */
+void Modbus_CRC_Init(modbus_crc_state_t *state);
+
+/** \brief 将数据并入CRC计算状态,可在每次接收到数据时调用
+ *
+ * \param state CRC计算状态
+ * \param data 数据指针
+ * \param data_length 数据长度
+ *
+ */
+void Modbus_CRC_Update(modbus_crc_state_t *state,const uint8_t *data,size_t data_length);
+
+/** \brief 获取当前的CRC值(已并入数据的CRC)
+ *
+ * \param state CRC计算状态
+ * \return CRC值,发送时低字节在前
+ *
+ */
+uint16_t Modbus_CRC_Final(const modbus_crc_state_t *state);
+
+/** \brief 检查整帧数据(包含CRC)的CRC计算状态,不需要再次遍历数据
+ *
+ * \param state 已并入整帧数据(包含CRC)的CRC计算状态
+ * \return CRC是否通过
+ *
+ */
+bool Modbus_CRC_Check(const modbus_crc_state_t *state);
+
+/** \brief 根据已接收的数据预测请求帧(主机发往从机,RTU模式)的总长度
+ *
+ * \param data 已接收的数据(从从机地址开始)
+ * \param data_length 已接收的数据长度
+ * \return int 大于0:帧总长度(包含CRC),0:数据不足以预测,小于0:未知功能码
+ *
+ */
+int Modbus_RTU_Predict_Request_Length(const uint8_t *data,size_t data_length);
+
+/** \brief 根据已接收的数据预测回应帧(从机发往主机,RTU模式)的总长度
+ *
+ * \param data 已接收的数据(从从机地址开始)
+ * \param data_length 已接收的数据长度
+ * \return int 大于0:帧总长度(包含CRC),0:数据不足以预测,小于0:未知功能码
+ *
+ */
+int Modbus_RTU_Predict_Response_Length(const uint8_t *data,size_t data_length);
+
+/** \brief 根据已接收的MBAP报文头得到TCP帧(请求或回应)的总长度
+ *
+ * \param data 已接收的数据(从事务标识开始)
+ * \param data_length 已接收的数据长度
+ * \return int 大于0:帧总长度(包含MBAP报文头),0:数据不足6字节,小于0:协议标识不为0或长度不正确
+ *
+ */
+int Modbus_TCP_Predict_Length(const uint8_t *data,size_t data_length);
+
+/** \brief 填写MBAP报文头的前6字节(事务标识、协议标识及长度),单元标识(第7字节)及PDU需已位于其后
+ *
+ * \param header MBAP报文头的指针
+ * \param transaction_id 事务标识
+ * \param length 单元标识及PDU的长度
+ *
+ */
+void Modbus_TCP_Write_MBAP(uint8_t *header,uint16_t transaction_id,size_t length);
+
+typedef enum
+{
+    MODBUS_TABLE_IX=0,/**< 输入点(离散输入),功能码0x02 */
+    MODBUS_TABLE_OX,/**< 输出线圈,功能码0x01/0x05/0x0F */
+    MODBUS_TABLE_INPUT_REGISTER,/**< 输入寄存器,功能码0x04 */
+    MODBUS_TABLE_HOLD_REGISTER,/**< 保持寄存器,功能码0x03/0x06/0x10 */
+    MODBUS_TABLE_MAX,/**< 表的数量 */
+} modbus_table_t/**< Modbus数据表 */;
+
+typedef struct modbus_register_bank modbus_register_bank_t;/**< 寄存器存储,定义见ModbusRegisterBank.h */
+
+typedef struct modbus_address_index modbus_address_index_t;/**< 稀疏地址索引,定义见ModbusAddressIndex.h */
+
+typedef struct modbus_master_policy modbus_master_policy_t;/**< 主机超时、重试及熔断策略,定义见ModbusMasterPolicy.h */
+
+
 
 typedef struct
 {
@@ -139,6 +319,106 @@ typedef struct
      */
     uint16_t (*read_input_register)(size_t addr);
 
+    /** \brief 批量读取输入点,可为NULL。不为NULL时代替read_IX使用,一次请求只调用一次。
+     *
+     * \param addr 起始地址
+     * \param data 数据(按位打包,第一个输入点为data[0]的最低位),调用前已清零
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*read_IXs)(size_t addr,uint8_t *data,size_t number);
+
+    /** \brief 批量读取输出线圈,可为NULL。不为NULL时代替read_OX使用,一次请求只调用一次。
+     *
+     * \param addr 起始地址
+     * \param data 数据(按位打包,第一个线圈为data[0]的最低位),调用前已清零
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*read_OXs)(size_t addr,uint8_t *data,size_t number);
+
+    /** \brief 批量读取保持寄存器,可为NULL。不为NULL时代替read_hold_register使用,一次请求只调用一次。
+     *
+     * \param addr 起始地址
+     * \param data 数据
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*read_hold_registers)(size_t addr,uint16_t *data,size_t number);
+
+    /** \brief 批量读取输入寄存器,可为NULL。不为NULL时代替read_input_register使用,一次请求只调用一次。
+     *
+     * \param addr 起始地址
+     * \param data 数据
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*read_input_registers)(size_t addr,uint16_t *data,size_t number);
+
+    /** \brief 批量写输出线圈(0x05/0x0F),可为NULL。不为NULL时代替write_OX使用,一次请求只调用一次。
+     *
+     * \param addr 起始地址
+     * \param data 数据(按位打包,第一个线圈为data[0]的最低位)
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*write_OXs)(size_t addr,const uint8_t *data,size_t number);
+
+    /** \brief 批量写保持寄存器(0x06/0x10),可为NULL。不为NULL时代替write_hold_register使用,一次请求只调用一次。
+     *
+     * \param addr 起始地址
+     * \param data 数据(已解码)
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*write_hold_registers)(size_t addr,const uint16_t *data,size_t number);
+
+    /** \brief 写请求开始,可为NULL。在一次写请求(0x05/0x06/0x0F/0x10/0x16/0x17)的所有写回调之前调用,可用于加锁或开始事务。
+     *
+     * \param function_code 功能码
+     * \param addr 起始地址
+     * \param number 数量
+     * \return 是否允许写入,返回false时不进行写入
+     *
+     */
+    bool (*write_begin)(uint8_t function_code,size_t addr,size_t number);
+
+    /** \brief 写请求结束,可为NULL。在一次写请求的所有写回调之后调用,可用于一次性(原子地)应用并保存整个请求。
+     *
+     * \param commit 为true时所有写回调均成功,应提交;为false时应回滚
+     * \return 是否提交成功
+     *
+     */
+    bool (*write_commit)(bool commit);
+
+    modbus_register_bank_t *bank;/**< 寄存器存储,可为NULL。地址范围位于寄存器存储中(且未被拦截)的请求直接读写寄存器存储,不调用回调函数 */
+
+    const modbus_address_index_t *index;/**< 稀疏地址索引,可为NULL。未使用寄存器存储且地址范围位于某个地址块中的请求由该地址块处理,每个请求只查找一次 */
+
+    /** \brief 分段输出函数,可为NULL。不为NULL时代替output输出回应。
+     * 回应按头部、数据部分、CRC分段输出,数据部分可能直接指向寄存器存储,不在缓冲中拼接整帧,缓冲也无需为CRC预留空间。
+     * \param iov 分段数据(仅在调用期间有效)
+     * \param iov_count 分段数量
+     *
+     */
+    void (*output_iov)(const modbus_iovec_t *iov,size_t iov_count);
+
+    /** \brief 屏蔽写保持寄存器(0x16),可为NULL。
+     * 不为NULL时由此函数原子地完成 新值=(当前值 & and_mask) | (or_mask & ~and_mask),否则在write_begin/write_commit之间读取后再写入。
+     * \param addr 地址
+     * \param and_mask 与屏蔽
+     * \param or_mask 或屏蔽
+     * \return 是否成功
+     *
+     */
+    bool (*mask_write_hold_register)(size_t addr,uint16_t and_mask,uint16_t or_mask);
+
 
 } modbus_slave_context_t/**< 从机的上下文结构定义 */;
 
@@ -147,16 +427,56 @@ typedef struct
 /** \brief Modbus从机解析输入。
  * 当从机接收到一帧数据后，调用此函数。
  * 此函数会自动调用相关回调函数完成Modbus输出。
+ * 请求不能执行时回应异常(功能码|0x80,异常码见modbus_exception_t),广播请求只执行写操作且不回应。
  * \param ctx 上下文指针,需要自行定义
  * \param input_data 输入数据指针
  * \param input_data_length 输入数据长度
- * \param buff 缓冲(存放临时数据)
- * \param buff_length 缓冲长度(需大于等于输入数据长度，足够存放输出数据)
+ * \param buff 缓冲(存放输出数据),可与input_data相同(原地构造回应,无需另外的缓冲)
+ * \param buff_length 缓冲长度(足够存放输出数据即可)
  * \return 是否成功执行
  *
  */
 bool Modbus_Slave_Parse_Input(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,uint8_t *buff,size_t buff_length);
 
+/** \brief Modbus从机解析输入(使用接收时已计算的CRC状态)。
+ * 与Modbus_Slave_Parse_Input相同,但不再遍历数据计算CRC。
+ * \param ctx 上下文指针,需要自行定义
+ * \param input_data 输入数据指针
+ * \param input_data_length 输入数据长度
+ * \param crc 已并入整帧输入数据(包含CRC)的CRC计算状态
+ * \param buff 缓冲(存放输出数据),可与input_data相同(原地构造回应,无需另外的缓冲)
+ * \param buff_length 缓冲长度(足够存放输出数据即可)
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Slave_Parse_Input_With_CRC(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,const modbus_crc_state_t *crc,uint8_t *buff,size_t buff_length);
+
+/** \brief Modbus从机解析分段输入。
+ * 与Modbus_Slave_Parse_Input相同,但输入数据可分为多段(如DMA环形缓冲中跨越末尾的一帧分为两段),不需要先拼接为连续数据。
+ * \param ctx 上下文指针,需要自行定义
+ * \param iov 整帧输入数据(包含CRC)的各段
+ * \param iov_count 分段数量
+ * \param buff 缓冲(存放输出数据)
+ * \param buff_length 缓冲长度(足够存放输出数据即可)
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Slave_Parse_Input_IOV(modbus_slave_context_t *ctx,const modbus_iovec_t *iov,size_t iov_count,uint8_t *buff,size_t buff_length);
+
+/** \brief Modbus从机解析TCP输入(一帧完整的MBAP帧)。
+ * 与Modbus_Slave_Parse_Input使用相同的PDU处理,回应使用请求的事务标识及单元标识,不计算CRC。
+ * 单元标识为本从机地址、0或MODBUS_TCP_UNIT_ID(0xFF)时处理并回应(TCP没有广播,0用于直接访问TCP设备)。
+ * \param ctx 上下文指针,需要自行定义
+ * \param input_data 输入数据指针(从事务标识开始)
+ * \param input_data_length 输入数据长度(需与MBAP报文头中的长度一致,见Modbus_TCP_Predict_Length)
+ * \param buff 缓冲(存放输出数据),可与input_data相同(原地构造回应,无需另外的缓冲)
+ * \param buff_length 缓冲长度(足够存放输出数据即可,最大为MODBUS_TCP_MAX_ADU_LENGTH)
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Slave_Parse_Input_TCP(modbus_slave_context_t *ctx,uint8_t *input_data,size_t input_data_length,uint8_t *buff,size_t buff_length);
+
+
 
 typedef struct
 {
@@ -172,7 +492,8 @@ typedef struct
     void (*output)(uint8_t *data,size_t data_length);
 
 
-    /** \brief 请求数据(读串口输入),当Modbus请求发出后，会调用此函数等待从机回应，不可为NULL。
+    /** \brief 请求数据(读串口输入),当Modbus请求发出后，会调用此函数等待从机回应，不可为NULL(设置了request_reply_with_crc时可为NULL)。
+     * 主机先请求3字节帧头,由帧头预测回应的实际长度(异常回应为5字节)后再请求剩余部分。返回的长度小于data_length时会继续请求剩余部分,返回0表示超时。
      *
      * \param data 请求数据的指针
      * \param data_length 请求数据的长度(最大)
@@ -181,6 +502,21 @@ typedef struct
      */
     size_t (*request_reply)(uint8_t *data,size_t data_length);
 
+    /** \brief 请求数据(读串口输入)并在接收时计算CRC,可为NULL。
+     * 若不为NULL,则代替request_reply使用,接收的每一段数据需通过Modbus_CRC_Update并入crc,主机不再遍历数据计算CRC。
+     *
+     * \param data 请求数据的指针
+     * \param data_length 请求数据的长度(最大)
+     * \param crc 已初始化的CRC计算状态
+     * \return size_t 成功读取的数据长度
+     *
+     */
+    size_t (*request_reply_with_crc)(uint8_t *data,size_t data_length,modbus_crc_state_t *crc);
+
+    modbus_master_policy_t *policy;/**< 超时、重试及熔断策略,可为NULL。不为NULL时request_reply返回0(超时)或回应错误后按策略重试,从机熔断期间不发送请求 */
+    modbus_framing_t framing;/**< 帧格式,为MODBUS_FRAMING_TCP时按MBAP帧发送请求(slave_addr为单元标识),request_reply先请求6字节报文头再请求剩余部分,缓冲最大为MODBUS_TCP_MAX_ADU_LENGTH */
+    uint16_t transaction_id;/**< 最近一次请求的事务标识(TCP,每次发送加1) */
+
 } modbus_master_context_t/**< 主机的上下文结构定义 */;
 
 
@@ -263,6 +599,74 @@ bool Modbus_Master_Write_OX(modbus_master_context_t *ctx,uint16_t start_addr,boo
  */
 bool Modbus_Master_Write_Hold_Register(modbus_master_context_t *ctx,uint16_t start_addr,uint16_t *data,size_t number,uint8_t *buff,size_t buff_length);
 
+/** \brief Modbus主机读取输出线圈(按位打包,不转换为bool数组)
+ *
+ * \param ctx 上下文指针,需要自行定义
+ * \param start_addr 起始地址(寻址地址)
+ * \param data 位图指针(低位在前),长度为(number+7)/8字节,最后一个字节多余的位为0
+ * \param number 待读取线圈数量
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Master_Read_OX_Packed(modbus_master_context_t *ctx,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length);
+
+/** \brief Modbus主机读取输入点(按位打包,不转换为bool数组)
+ *
+ * \param ctx 上下文指针,需要自行定义
+ * \param start_addr 起始地址(寻址地址)
+ * \param data 位图指针(低位在前),长度为(number+7)/8字节,最后一个字节多余的位为0
+ * \param number 待读取输入点数量
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Master_Read_IX_Packed(modbus_master_context_t *ctx,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length);
+
+/** \brief Modbus主机写输出线圈(按位打包,不转换为bool数组)
+ *
+ * \param ctx 上下文指针,需要自行定义
+ * \param start_addr 起始地址(寻址地址)
+ * \param data 位图指针(低位在前),长度为(number+7)/8字节
+ * \param number 待写入线圈数量
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Master_Write_OX_Packed(modbus_master_context_t *ctx,uint16_t start_addr,uint8_t *data,size_t number,uint8_t *buff,size_t buff_length);
+
+/** \brief Modbus主机写并读保持寄存器(0x17),一次请求中先写入再读取
+ *
+ * \param ctx 上下文指针,需要自行定义
+ * \param write_addr 写入起始地址(寻址地址)
+ * \param write_data 待写入的数据指针
+ * \param write_number 待写入数据长度(不超过MODBUS_MAX_WR_WRITE_REGISTERS)
+ * \param read_addr 读取起始地址(寻址地址)
+ * \param read_data 读取的数据指针
+ * \param read_number 读取数据长度(不超过MODBUS_MAX_WR_READ_REGISTERS)
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Master_Write_Read_Hold_Register(modbus_master_context_t *ctx,uint16_t write_addr,uint16_t *write_data,size_t write_number,uint16_t read_addr,uint16_t *read_data,size_t read_number,uint8_t *buff,size_t buff_length);
+
+/** \brief Modbus主机屏蔽写保持寄存器(0x16),从机中新值=(当前值 & and_mask) | (or_mask & ~and_mask)
+ *
+ * \param ctx 上下文指针,需要自行定义
+ * \param addr 地址(寻址地址)
+ * \param and_mask 与屏蔽(为1的位保持不变)
+ * \param or_mask 或屏蔽(与屏蔽为0的位设置为此值)
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 是否成功执行
+ *
+ */
+bool Modbus_Master_Mask_Write_Hold_Register(modbus_master_context_t *ctx,uint16_t addr,uint16_t and_mask,uint16_t or_mask,uint8_t *buff,size_t buff_length);
+
 #ifdef __cplusplus
 }
 #endif
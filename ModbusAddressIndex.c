@@ -0,0 +1,216 @@
+﻿/** \file ModbusAddressIndex.c
+ *  \brief     Modbus从机稀疏地址索引C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusAddressIndex.h"
+#include "ModbusPack.h"
+
+/*
+比较地址块的顺序(先按表,再按起始地址)
+*/
+static bool Modbus_Address_Block_Less(const modbus_address_block_t *a,modbus_table_t table,size_t addr)
+{
+    if(a->table!=table)
+    {
+        return a->table<table;
+    }
+    return a->range.base<addr;
+}
+
+bool Modbus_Address_Index_Init(modbus_address_index_t *index,modbus_address_block_t *blocks,size_t block_count)
+{
+    if(index==NULL || (blocks==NULL && block_count!=0))
+    {
+        return false;
+    }
+
+    //插入排序(地址块数量通常较少,且只在初始化时排序)
+    for(size_t i=1; i<block_count; i++)
+    {
+        modbus_address_block_t block=blocks[i];
+        size_t j=i;
+        while(j>0 && !Modbus_Address_Block_Less(&blocks[j-1],block.table,block.range.base))
+        {
+            blocks[j]=blocks[j-1];
+            j--;
+        }
+        blocks[j]=block;
+    }
+
+    for(size_t i=0; i<block_count; i++)
+    {
+        if(blocks[i].table>=MODBUS_TABLE_MAX || blocks[i].range.size==0 || (size_t)blocks[i].range.base+blocks[i].range.size>0x10000)
+        {
+            return false;
+        }
+        if(i>0 && blocks[i-1].table==blocks[i].table && (size_t)blocks[i-1].range.base+blocks[i-1].range.size>blocks[i].range.base)
+        {
+            //地址块重叠
+            return false;
+        }
+    }
+
+    index->blocks=blocks;
+    index->block_count=block_count;
+
+    return true;
+}
+
+const modbus_address_block_t *Modbus_Address_Index_Find(const modbus_address_index_t *index,modbus_table_t table,size_t addr,size_t number)
+{
+    if(index==NULL || index->blocks==NULL || number==0)
+    {
+        return NULL;
+    }
+
+    //二分查找最后一个起始地址不大于addr的地址块
+    size_t low=0;
+    size_t high=index->block_count;
+    while(low<high)
+    {
+        size_t mid=low+(high-low)/2;
+        if(Modbus_Address_Block_Less(&index->blocks[mid],table,addr+1))
+        {
+            low=mid+1;
+        }
+        else
+        {
+            high=mid;
+        }
+    }
+
+    if(low==0)
+    {
+        return NULL;
+    }
+
+    const modbus_address_block_t *block=&index->blocks[low-1];
+    if(block->table!=table || addr<block->range.base || number>block->range.size || (addr-block->range.base)>(block->range.size-number))
+    {
+        return NULL;
+    }
+
+    return block;
+}
+
+bool Modbus_Address_Block_Read_Bits(const modbus_address_block_t *block,size_t addr,uint8_t *data,size_t number)
+{
+    if(block==NULL || data==NULL || number==0)
+    {
+        return false;
+    }
+
+    if(block->range.data!=NULL)
+    {
+        return Modbus_Register_Bank_Table_Read_Bits(&block->range,addr,data,number);
+    }
+
+    if(block->read_bits==NULL)
+    {
+        return false;
+    }
+
+    size_t byte_count=(number+7)/8;
+    memset(data,0,byte_count);
+    if(!block->read_bits(block,addr,data,number))
+    {
+        return false;
+    }
+    if(number%8!=0)
+    {
+        //多余的位填0
+        data[byte_count-1]&=(0xFF>>(8-number%8));
+    }
+    return true;
+}
+
+bool Modbus_Address_Block_Write_Bits(const modbus_address_block_t *block,size_t addr,const uint8_t *data,size_t number)
+{
+    if(block==NULL || data==NULL || number==0)
+    {
+        return false;
+    }
+
+    if(block->range.data!=NULL)
+    {
+        if(!Modbus_Register_Bank_Table_Write_Bits(&block->range,addr,data,number))
+        {
+            return false;
+        }
+        if(block->on_write!=NULL)
+        {
+            block->on_write(block,addr,number);
+        }
+        return true;
+    }
+
+    if(block->write_bits==NULL)
+    {
+        return false;
+    }
+
+    return block->write_bits(block,addr,data,number);
+}
+
+bool Modbus_Address_Block_Read_Registers(const modbus_address_block_t *block,size_t addr,uint8_t *data,size_t number)
+{
+    if(block==NULL || data==NULL || number==0)
+    {
+        return false;
+    }
+
+    if(block->range.data!=NULL)
+    {
+        return Modbus_Register_Bank_Table_Read_Registers(&block->range,addr,data,number);
+    }
+
+    uint16_t registers[MODBUS_MAX_WR_READ_REGISTERS];
+    if(block->read_registers==NULL || number>MODBUS_MAX_WR_READ_REGISTERS)
+    {
+        return false;
+    }
+
+    if(!block->read_registers(block,addr,registers,number))
+    {
+        return false;
+    }
+
+    Modbus_Pack_Registers(data,registers,number);
+
+    return true;
+}
+
+bool Modbus_Address_Block_Write_Registers(const modbus_address_block_t *block,size_t addr,const uint8_t *data,size_t number)
+{
+    if(block==NULL || data==NULL || number==0)
+    {
+        return false;
+    }
+
+    if(block->range.data!=NULL)
+    {
+        if(!Modbus_Register_Bank_Table_Write_Registers(&block->range,addr,data,number))
+        {
+            return false;
+        }
+        if(block->on_write!=NULL)
+        {
+            block->on_write(block,addr,number);
+        }
+        return true;
+    }
+
+    uint16_t registers[MODBUS_MAX_WRITE_REGISTERS];
+    if(block->write_registers==NULL || number>MODBUS_MAX_WRITE_REGISTERS)
+    {
+        return false;
+    }
+
+    Modbus_Unpack_Registers(registers,data,number);
+
+    return block->write_registers(block,addr,registers,number);
+}
@@ -0,0 +1,157 @@
+﻿/** \file ModbusAddressIndex.h
+ *  \brief     Modbus从机稀疏地址索引头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_ADDRESS_INDEX_H__
+#define __MODBUS_ADDRESS_INDEX_H__
+
+#include "Modbus.h"
+#include "ModbusRegisterBank.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct modbus_address_block modbus_address_block_t;
+
+struct modbus_address_block
+{
+    modbus_table_t table;/**< 表 */
+    modbus_register_bank_table_t range;/**< 地址范围(base,size)及存储数组(data),data为NULL时使用下列回调函数 */
+
+    /** \brief 读取线圈/输入点,可为NULL。
+     *
+     * \param block 地址块
+     * \param addr 起始地址
+     * \param data 数据(按位打包,低位在前),调用前已清零
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*read_bits)(const modbus_address_block_t *block,size_t addr,uint8_t *data,size_t number);
+
+    /** \brief 写入线圈,可为NULL(此时只读)。
+     *
+     * \param block 地址块
+     * \param addr 起始地址
+     * \param data 数据(按位打包,低位在前)
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*write_bits)(const modbus_address_block_t *block,size_t addr,const uint8_t *data,size_t number);
+
+    /** \brief 读取寄存器,可为NULL。
+     *
+     * \param block 地址块
+     * \param addr 起始地址
+     * \param data 数据
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*read_registers)(const modbus_address_block_t *block,size_t addr,uint16_t *data,size_t number);
+
+    /** \brief 写入寄存器,可为NULL(此时只读)。
+     *
+     * \param block 地址块
+     * \param addr 起始地址
+     * \param data 数据
+     * \param number 数量
+     * \return 是否成功
+     *
+     */
+    bool (*write_registers)(const modbus_address_block_t *block,size_t addr,const uint16_t *data,size_t number);
+
+    /** \brief 写入通知,可为NULL。主机写入存储数组后调用。
+     *
+     * \param block 地址块
+     * \param addr 起始地址
+     * \param number 数量
+     *
+     */
+    void (*on_write)(const modbus_address_block_t *block,size_t addr,size_t number);
+
+    void *usr;/**< 用户数据 */
+}/**< 地址块,表示一个表中的一段连续地址 */;
+
+struct modbus_address_index
+{
+    modbus_address_block_t *blocks;/**< 地址块数组(由用户定义),初始化时按表及起始地址排序 */
+    size_t block_count;/**< 地址块数量 */
+}/**< 稀疏地址索引,请求只需一次二分查找(O(log n))即可找到地址块 */;
+
+/** \brief 初始化稀疏地址索引。
+ * 地址块数组将被排序,同一表中的地址块不能重叠。
+ * \param index 稀疏地址索引
+ * \param blocks 地址块数组
+ * \param block_count 地址块数量
+ * \return 是否成功(地址块重叠或参数错误时失败)
+ *
+ */
+bool Modbus_Address_Index_Init(modbus_address_index_t *index,modbus_address_block_t *blocks,size_t block_count);
+
+/** \brief 查找包含整个地址范围的地址块
+ *
+ * \param index 稀疏地址索引
+ * \param table 表
+ * \param addr 起始地址
+ * \param number 数量
+ * \return 地址块,未找到(或跨越多个地址块)时返回NULL
+ *
+ */
+const modbus_address_block_t *Modbus_Address_Index_Find(const modbus_address_index_t *index,modbus_table_t table,size_t addr,size_t number);
+
+/** \brief 从地址块读取线圈/输入点
+ *
+ * \param block 地址块
+ * \param addr 起始地址
+ * \param data 数据(按位打包,低位在前,多余的位填0)
+ * \param number 数量
+ * \return 是否成功
+ *
+ */
+bool Modbus_Address_Block_Read_Bits(const modbus_address_block_t *block,size_t addr,uint8_t *data,size_t number);
+
+/** \brief 向地址块写入线圈
+ *
+ * \param block 地址块
+ * \param addr 起始地址
+ * \param data 数据(按位打包,低位在前)
+ * \param number 数量
+ * \return 是否成功
+ *
+ */
+bool Modbus_Address_Block_Write_Bits(const modbus_address_block_t *block,size_t addr,const uint8_t *data,size_t number);
+
+/** \brief 从地址块读取寄存器并转换为Modbus数据帧格式(高字节在前)
+ *
+ * \param block 地址块
+ * \param addr 起始地址
+ * \param data 数据(高字节在前),长度为number*2
+ * \param number 数量(不超过MODBUS_MAX_WR_READ_REGISTERS)
+ * \return 是否成功
+ *
+ */
+bool Modbus_Address_Block_Read_Registers(const modbus_address_block_t *block,size_t addr,uint8_t *data,size_t number);
+
+/** \brief 向地址块写入Modbus数据帧格式(高字节在前)的寄存器
+ *
+ * \param block 地址块
+ * \param addr 起始地址
+ * \param data 数据(高字节在前),长度为number*2
+ * \param number 数量(不超过MODBUS_MAX_WRITE_REGISTERS)
+ * \return 是否成功
+ *
+ */
+bool Modbus_Address_Block_Write_Registers(const modbus_address_block_t *block,size_t addr,const uint8_t *data,size_t number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,608 @@
+﻿/** \file ModbusCoroutine.h
+ *  \brief     Modbus主机C++20协程接口(仅头文件)
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ *
+ * 基于ModbusMasterEngine.h的主机请求引擎,提供可co_await的读写请求及定时器。
+ * 单线程执行器可同时驱动多条总线,每条总线上的请求按提交顺序依次发送。示例:
+ * \code
+ * modbus::task<> poll_loop(modbus::executor &exec,modbus::master &bus)
+ * {
+ *     uint16_t regs[10];
+ *     for(;;)
+ *     {
+ *         if(co_await bus.read_holding(1,0,regs)==MODBUS_MASTER_STATUS_OK)
+ *         {
+ *             ...
+ *         }
+ *         co_await exec.sleep_for(std::chrono::milliseconds(100));
+ *     }
+ * }
+ *
+ * modbus::executor exec;
+ * modbus::master bus(exec,[](const uint8_t *data,size_t length){ ... 串口输出 ... });
+ * exec.spawn(poll_loop(exec,bus));
+ * for(;;)
+ * {
+ *     ... 等待串口数据(最长exec.timeout_ms()毫秒),收到数据时调用bus.feed(data,length) ...
+ *     exec.poll();
+ * }
+ * \endcode
+ */
+
+#ifndef __MODBUS_COROUTINE_H__
+#define __MODBUS_COROUTINE_H__
+
+#if defined(__cplusplus) && (__cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L))
+
+#include "Modbus.h"
+#include "ModbusMasterEngine.h"
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace modbus
+{
+
+template<typename T=void>
+class task;
+
+namespace detail
+{
+
+/*
+协程返回值存储
+*/
+template<typename T>
+struct task_result
+{
+    std::optional<T> value;
+    template<typename U>
+    void return_value(U &&v)
+    {
+        value.emplace(std::forward<U>(v));
+    }
+    T take()
+    {
+        return std::move(*value);
+    }
+};
+
+template<>
+struct task_result<void>
+{
+    void return_void()
+    {
+    }
+    void take()
+    {
+    }
+};
+
+template<typename T>
+struct task_promise:public task_result<T>
+{
+    std::coroutine_handle<> continuation;/**< 等待此协程的协程 */
+    std::exception_ptr exception;/**< 协程中未处理的异常 */
+    bool detached=false;/**< 是否由执行器拥有(spawn) */
+
+    task<T> get_return_object();
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise> h) noexcept
+        {
+            task_promise &p=h.promise();
+            if(p.detached)
+            {
+                //由执行器拥有的协程结束后自行销毁,未处理的异常无法传递
+                if(p.exception)
+                {
+                    std::terminate();
+                }
+                h.destroy();
+                return std::noop_coroutine();
+            }
+            if(p.continuation)
+            {
+                return p.continuation;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    final_awaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        exception=std::current_exception();
+    }
+};
+
+}
+
+/** \brief 协程任务。创建后不立即执行,需要co_await(在其它协程中)或交给executor::spawn执行。
+ */
+template<typename T>
+class task
+{
+public:
+    using promise_type=detail::task_promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h):handle(h)
+    {
+    }
+    task(task &&other) noexcept:handle(std::exchange(other.handle,nullptr))
+    {
+    }
+    task &operator=(task &&other) noexcept
+    {
+        if(this!=&other)
+        {
+            if(handle)
+            {
+                handle.destroy();
+            }
+            handle=std::exchange(other.handle,nullptr);
+        }
+        return *this;
+    }
+    task(const task &)=delete;
+    task &operator=(const task &)=delete;
+    ~task()
+    {
+        if(handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return !handle || handle.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        handle.promise().continuation=caller;
+        return handle;
+    }
+    T await_resume()
+    {
+        if(handle.promise().exception)
+        {
+            std::rethrow_exception(handle.promise().exception);
+        }
+        return handle.promise().take();
+    }
+
+    /** \brief 交出协程所有权(供执行器使用)
+     *
+     * \return 协程句柄
+     *
+     */
+    std::coroutine_handle<promise_type> release() noexcept
+    {
+        return std::exchange(handle,nullptr);
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<typename T>
+task<T> detail::task_promise<T>::get_return_object()
+{
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+class master;
+
+/** \brief 单线程执行器,管理就绪的协程、定时器及总线(主机请求引擎)。
+ * 所有成员函数只能在同一线程中调用。
+ */
+class executor
+{
+public:
+    using clock=std::chrono::steady_clock;
+
+    executor()=default;
+    executor(const executor &)=delete;
+    executor &operator=(const executor &)=delete;
+
+    /** \brief 启动协程任务,任务结束后自动销毁
+     *
+     * \param t 协程任务
+     *
+     */
+    void spawn(task<void> t)
+    {
+        auto h=t.release();
+        if(h)
+        {
+            h.promise().detached=true;
+            schedule(h);
+        }
+    }
+
+    /** \brief 将协程加入就绪队列,在下一次poll时恢复
+     *
+     * \param h 协程句柄
+     *
+     */
+    void schedule(std::coroutine_handle<> h)
+    {
+        ready.push_back(h);
+    }
+
+    /** \brief 处理超时(所有总线及定时器)并恢复所有就绪的协程
+     *
+     * \return 恢复的协程数量
+     *
+     */
+    size_t poll();
+
+    /** \brief 获取下一次需要调用poll的时间,可用作epoll_wait等函数的超时时间
+     *
+     * \return 毫秒数,有就绪的协程时为0,没有定时器及等待回应的请求时为-1
+     *
+     */
+    int timeout_ms() const;
+
+    /** \brief 当前时间戳(毫秒),即主机请求引擎使用的时间戳
+     *
+     * \return 时间戳
+     *
+     */
+    static uint32_t now()
+    {
+        return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(clock::now().time_since_epoch()).count();
+    }
+
+    /** \brief 定时器,co_await后挂起直到超时
+     */
+    struct sleep_awaiter
+    {
+        executor *exec;
+        clock::time_point deadline;
+
+        bool await_ready() const noexcept
+        {
+            return clock::now()>=deadline;
+        }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            exec->timers.emplace(deadline,h);
+        }
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    /** \brief 挂起当前协程一段时间
+     *
+     * \param duration 时间
+     * \return 可co_await的定时器
+     *
+     */
+    template<typename Rep,typename Period>
+    sleep_awaiter sleep_for(std::chrono::duration<Rep,Period> duration)
+    {
+        return sleep_awaiter{this,clock::now()+std::chrono::duration_cast<clock::duration>(duration)};
+    }
+
+    /** \brief 挂起当前协程直到某一时刻
+     *
+     * \param deadline 时刻
+     * \return 可co_await的定时器
+     *
+     */
+    sleep_awaiter sleep_until(clock::time_point deadline)
+    {
+        return sleep_awaiter{this,deadline};
+    }
+
+private:
+    friend class master;
+
+    std::deque<std::coroutine_handle<>> ready;/**< 就绪的协程 */
+    std::multimap<clock::time_point,std::coroutine_handle<>> timers;/**< 定时器 */
+    std::vector<master *> masters;/**< 总线 */
+};
+
+/** \brief 一条总线上的主机,所有请求通过主机请求引擎依次发送。不可复制或移动。
+ */
+class master
+{
+public:
+    using output_function=std::function<void(const uint8_t *data,size_t data_length)>;
+
+    /** \brief 构造主机
+     *
+     * \param exec 执行器
+     * \param output 输出函数(发送请求)
+     * \param default_timeout 默认的回应超时时间(毫秒)
+     *
+     */
+    master(executor &exec,output_function output,uint32_t default_timeout=1000):exec(exec),output(std::move(output)),default_timeout(default_timeout)
+    {
+        Modbus_Master_Engine_Init(&engine,buffer.data(),buffer.size(),&master::engine_output,this);
+        exec.masters.push_back(this);
+    }
+    master(const master &)=delete;
+    master &operator=(const master &)=delete;
+    ~master()
+    {
+        Modbus_Master_Engine_Cancel(&engine);
+        std::erase(exec.masters,this);
+    }
+
+    /** \brief 输入接收到的数据(任意长度),完成的请求在下一次executor::poll时恢复
+     *
+     * \param data 数据
+     * \param data_length 数据长度
+     *
+     */
+    void feed(const uint8_t *data,size_t data_length)
+    {
+        Modbus_Master_Engine_Feed(&engine,data,data_length,executor::now());
+    }
+
+    /** \brief 请求,co_await后挂起直到请求完成,结果为请求状态
+     */
+    struct request_awaiter
+    {
+        master *m;
+        modbus_master_request_t request;
+        std::coroutine_handle<> handle;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            handle=h;
+            request.usr=this;
+            request.complete=&request_awaiter::complete;
+            //参数不正确时不挂起
+            return Modbus_Master_Engine_Submit(&m->engine,&request,executor::now());
+        }
+        modbus_master_status_t await_resume() const noexcept
+        {
+            return request.status;
+        }
+        modbus_exception_t exception() const noexcept
+        {
+            return request.exception;
+        }
+        static void complete(modbus_master_request_t *request)
+        {
+            request_awaiter *awaiter=(request_awaiter *)request->usr;
+            awaiter->m->exec.schedule(awaiter->handle);
+        }
+    };
+
+    /** \brief 读取输出线圈(0x01)
+     */
+    request_awaiter read_coils(uint8_t slave,uint16_t addr,std::span<bool> data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make(slave,0x01,addr,data.size(),data.data(),nullptr,timeout);
+    }
+
+    /** \brief 读取输入点(0x02)
+     */
+    request_awaiter read_discrete(uint8_t slave,uint16_t addr,std::span<bool> data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make(slave,0x02,addr,data.size(),data.data(),nullptr,timeout);
+    }
+
+    /** \brief 读取保持寄存器(0x03)
+     */
+    request_awaiter read_holding(uint8_t slave,uint16_t addr,std::span<uint16_t> data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make(slave,0x03,addr,data.size(),nullptr,data.data(),timeout);
+    }
+
+    /** \brief 读取输入寄存器(0x04)
+     */
+    request_awaiter read_input(uint8_t slave,uint16_t addr,std::span<uint16_t> data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make(slave,0x04,addr,data.size(),nullptr,data.data(),timeout);
+    }
+
+    /** \brief 写输出线圈(单个时为0x05,否则为0x0F),数据在请求完成前必须有效
+     */
+    request_awaiter write_coils(uint8_t slave,uint16_t addr,std::span<const bool> data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make(slave,(data.size()==1)?0x05:0x0F,addr,data.size(),const_cast<bool *>(data.data()),nullptr,timeout);
+    }
+
+    /** \brief 写保持寄存器(单个时为0x06,否则为0x10),数据在请求完成前必须有效
+     */
+    request_awaiter write_holding(uint8_t slave,uint16_t addr,std::span<const uint16_t> data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make(slave,(data.size()==1)?0x06:0x10,addr,data.size(),nullptr,const_cast<uint16_t *>(data.data()),timeout);
+    }
+
+    /** \brief 读取输出线圈(0x01),按位打包(低位在前),data至少(number+7)/8字节
+     */
+    request_awaiter read_coils_packed(uint8_t slave,uint16_t addr,std::span<uint8_t> data,size_t number,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make_packed(slave,0x01,addr,data,number,timeout);
+    }
+
+    /** \brief 读取输入点(0x02),按位打包(低位在前),data至少(number+7)/8字节
+     */
+    request_awaiter read_discrete_packed(uint8_t slave,uint16_t addr,std::span<uint8_t> data,size_t number,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make_packed(slave,0x02,addr,data,number,timeout);
+    }
+
+    /** \brief 写输出线圈(单个时为0x05,否则为0x0F),按位打包(低位在前),数据在请求完成前必须有效
+     */
+    request_awaiter write_coils_packed(uint8_t slave,uint16_t addr,std::span<const uint8_t> data,size_t number,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        return make_packed(slave,(number==1)?0x05:0x0F,addr,std::span<uint8_t>(const_cast<uint8_t *>(data.data()),data.size()),number,timeout);
+    }
+
+    /** \brief 屏蔽写保持寄存器(0x16)
+     */
+    request_awaiter mask_write_holding(uint8_t slave,uint16_t addr,uint16_t and_mask,uint16_t or_mask,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        request_awaiter awaiter=make(slave,0x16,addr,1,nullptr,nullptr,timeout);
+        awaiter.request.and_mask=and_mask;
+        awaiter.request.or_mask=or_mask;
+        return awaiter;
+    }
+
+    /** \brief 写并读保持寄存器(0x17),先写入再读取,数据在请求完成前必须有效
+     */
+    request_awaiter write_read_holding(uint8_t slave,uint16_t write_addr,std::span<const uint16_t> write_data,uint16_t read_addr,std::span<uint16_t> read_data,std::optional<uint32_t> timeout=std::nullopt)
+    {
+        request_awaiter awaiter=make(slave,0x17,read_addr,read_data.size(),nullptr,read_data.data(),timeout);
+        awaiter.request.write_addr=write_addr;
+        awaiter.request.write_number=write_data.size();
+        awaiter.request.write_registers=const_cast<uint16_t *>(write_data.data());
+        return awaiter;
+    }
+
+    /** \brief 是否有请求正在等待回应或排队
+     */
+    bool busy() const
+    {
+        return Modbus_Master_Engine_Busy(&engine);
+    }
+
+private:
+    friend class executor;
+
+    request_awaiter make(uint8_t slave,uint8_t function_code,uint16_t addr,size_t number,bool *bits,uint16_t *registers,std::optional<uint32_t> timeout)
+    {
+        request_awaiter awaiter {};
+        awaiter.m=this;
+        awaiter.request.slave_addr=slave;
+        awaiter.request.function_code=function_code;
+        awaiter.request.start_addr=addr;
+        awaiter.request.number=number;
+        awaiter.request.bits=bits;
+        awaiter.request.registers=registers;
+        awaiter.request.timeout=timeout.value_or(default_timeout);
+        return awaiter;
+    }
+
+    request_awaiter make_packed(uint8_t slave,uint8_t function_code,uint16_t addr,std::span<uint8_t> data,size_t number,std::optional<uint32_t> timeout)
+    {
+        //位图长度不足时数量置0,提交时返回参数不正确
+        request_awaiter awaiter=make(slave,function_code,addr,(data.size()*8>=number)?number:0,nullptr,nullptr,timeout);
+        awaiter.request.packed_bits=data.data();
+        return awaiter;
+    }
+
+    static void engine_output(modbus_master_engine_t *engine,uint8_t *data,size_t data_length)
+    {
+        master *m=(master *)engine->usr;
+        if(m->output)
+        {
+            m->output(data,data_length);
+        }
+    }
+
+    executor &exec;
+    output_function output;
+    uint32_t default_timeout;
+    std::array<uint8_t,MODBUS_RTU_MAX_ADU_LENGTH> buffer {};
+    modbus_master_engine_t engine {};
+};
+
+inline size_t executor::poll()
+{
+    uint32_t timestamp=now();
+    for(master *m:masters)
+    {
+        Modbus_Master_Engine_Tick(&m->engine,timestamp);
+    }
+
+    clock::time_point current=clock::now();
+    while(!timers.empty() && timers.begin()->first<=current)
+    {
+        ready.push_back(timers.begin()->second);
+        timers.erase(timers.begin());
+    }
+
+    //只恢复本次调用前就绪的协程,恢复过程中新就绪的协程在下一次调用时恢复
+    size_t count=ready.size();
+    for(size_t i=0; i<count; i++)
+    {
+        std::coroutine_handle<> h=ready.front();
+        ready.pop_front();
+        h.resume();
+    }
+    return count;
+}
+
+inline int executor::timeout_ms() const
+{
+    if(!ready.empty())
+    {
+        return 0;
+    }
+
+    int64_t timeout=-1;
+    uint32_t timestamp=now();
+    for(const master *m:masters)
+    {
+        if(m->engine.current!=NULL && m->engine.timeout!=0)
+        {
+            int32_t remain=(int32_t)(m->engine.deadline-timestamp);
+            int64_t t=(remain>0)?remain:0;
+            if(timeout<0 || t<timeout)
+            {
+                timeout=t;
+            }
+        }
+    }
+
+    if(!timers.empty())
+    {
+        auto remain=std::chrono::ceil<std::chrono::milliseconds>(timers.begin()->first-clock::now()).count();
+        int64_t t=(remain>0)?remain:0;
+        if(timeout<0 || t<timeout)
+        {
+            timeout=t;
+        }
+    }
+
+    return (int)timeout;
+}
+
+}
+
+#endif
+
+#endif
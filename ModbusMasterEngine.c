@@ -0,0 +1,707 @@
+﻿/** \file ModbusMasterEngine.c
+ *  \brief     Modbus主机非阻塞请求引擎C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusMasterEngine.h"
+#include "ModbusPack.h"
+
+/*
+检查请求参数并计算请求长度及回应长度(广播请求的回应长度为0),参数不正确时返回false。
+TCP的单元标识0用于直接访问TCP设备,不是广播。
+*/
+static bool Modbus_Master_Engine_Lengths(const modbus_master_request_t *request,modbus_framing_t framing,size_t *output_length,size_t *reply_length)
+{
+    size_t number=request->number;
+    bool broadcast=(framing!=MODBUS_FRAMING_TCP && request->slave_addr==MODBUS_BROADCAST_ADDRESS);
+    size_t input_length=8;
+
+    switch(request->function_code)
+    {
+    case 0x01:
+    case 0x02:
+    {
+        if(broadcast || (request->bits==NULL && request->packed_bits==NULL) || number==0 || number>MODBUS_MAX_READ_BITS)
+        {
+            return false;
+        }
+        *output_length=8;
+        input_length=5+number/8+((number%8!=0)?1:0);
+    }
+    break;
+    case 0x03:
+    case 0x04:
+    {
+        if(broadcast || request->registers==NULL || number==0 || number>MODBUS_MAX_READ_REGISTERS)
+        {
+            return false;
+        }
+        *output_length=8;
+        input_length=5+number*2;
+    }
+    break;
+    case 0x05:
+    {
+        if((request->bits==NULL && request->packed_bits==NULL) || number!=1)
+        {
+            return false;
+        }
+        *output_length=8;
+    }
+    break;
+    case 0x06:
+    {
+        if(request->registers==NULL || number!=1)
+        {
+            return false;
+        }
+        *output_length=8;
+    }
+    break;
+    case 0x0F:
+    {
+        if((request->bits==NULL && request->packed_bits==NULL) || number==0 || number>MODBUS_MAX_WRITE_BITS)
+        {
+            return false;
+        }
+        *output_length=9+number/8+((number%8!=0)?1:0);
+    }
+    break;
+    case 0x10:
+    {
+        if(request->registers==NULL || number==0 || number>MODBUS_MAX_WRITE_REGISTERS)
+        {
+            return false;
+        }
+        *output_length=9+number*2;
+    }
+    break;
+    case 0x16:
+    {
+        if(number!=1)
+        {
+            return false;
+        }
+        *output_length=10;
+        input_length=10;
+    }
+    break;
+    case 0x17:
+    {
+        if(broadcast || request->registers==NULL || number==0 || number>MODBUS_MAX_WR_READ_REGISTERS)
+        {
+            return false;
+        }
+        if(request->write_registers==NULL || request->write_number==0 || request->write_number>MODBUS_MAX_WR_WRITE_REGISTERS)
+        {
+            return false;
+        }
+        *output_length=13+request->write_number*2;
+        input_length=5+number*2;
+    }
+    break;
+    default:
+        return false;
+    }
+
+    *reply_length=broadcast?0:input_length;
+    return true;
+}
+
+/*
+检查请求参数并按帧格式计算请求长度及回应长度(TCP以6字节MBAP报文头代替2字节CRC)
+*/
+static bool Modbus_Master_Engine_Frame_Lengths(const modbus_master_engine_t *engine,const modbus_master_request_t *request,size_t *output_length,size_t *reply_length)
+{
+    if(!Modbus_Master_Engine_Lengths(request,engine->framing,output_length,reply_length))
+    {
+        return false;
+    }
+
+    if(engine->framing==MODBUS_FRAMING_TCP)
+    {
+        (*output_length)+=MODBUS_TCP_MBAP_LENGTH-3;
+        if((*reply_length)!=0)
+        {
+            (*reply_length)+=MODBUS_TCP_MBAP_LENGTH-3;
+        }
+    }
+
+    return true;
+}
+
+/*
+回应帧头的长度,收到帧头后即可得到回应的实际长度
+*/
+static size_t Modbus_Master_Engine_Header_Length(const modbus_master_engine_t *engine)
+{
+    return (engine->framing==MODBUS_FRAMING_TCP)?(MODBUS_TCP_MBAP_LENGTH-1):3;
+}
+
+/*
+请求中的第一个线圈(0x05使用)
+*/
+static bool Modbus_Master_Engine_First_Bit(const modbus_master_request_t *request)
+{
+    return (request->packed_bits!=NULL)?((request->packed_bits[0]&0x01)!=0):request->bits[0];
+}
+
+/*
+在缓冲中填写请求,返回请求长度。从机地址及PDU与帧格式无关,RTU在其后附加CRC,TCP在其前填写MBAP报文头。
+*/
+static size_t Modbus_Master_Engine_Encode(const modbus_master_engine_t *engine,const modbus_master_request_t *request,uint8_t *frame_buff)
+{
+    size_t output_length=0;
+    size_t reply_length=0;
+    if(!Modbus_Master_Engine_Lengths(request,engine->framing,&output_length,&reply_length))
+    {
+        return 0;
+    }
+
+    uint8_t *buff=frame_buff;
+    if(engine->framing==MODBUS_FRAMING_TCP)
+    {
+        buff=&frame_buff[MODBUS_TCP_MBAP_LENGTH-1];
+    }
+
+    size_t number=request->number;
+    buff[0]=request->slave_addr;
+    buff[1]=request->function_code;
+    Modbus_WriteUint16_To_2Bytes(&buff[2],request->start_addr);
+
+    switch(request->function_code)
+    {
+    case 0x05:
+    {
+        Modbus_WriteUint16_To_2Bytes(&buff[4],Modbus_Master_Engine_First_Bit(request)?(0xFF00):(0x0000));
+    }
+    break;
+    case 0x06:
+    {
+        Modbus_WriteUint16_To_2Bytes(&buff[4],request->registers[0]);
+    }
+    break;
+    case 0x0F:
+    {
+        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
+        buff[6]=number/8+((number%8!=0)?1:0);
+        if(request->packed_bits!=NULL)
+        {
+            memcpy(&buff[7],request->packed_bits,buff[6]);
+            if(number%8!=0)
+            {
+                //多余的位填0
+                buff[6+buff[6]]&=(0xFF>>(8-number%8));
+            }
+        }
+        else
+        {
+            Modbus_Pack_Bits(&buff[7],request->bits,number);
+        }
+    }
+    break;
+    case 0x10:
+    {
+        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
+        buff[6]=number*2;
+        Modbus_Pack_Registers(&buff[7],request->registers,number);
+    }
+    break;
+    case 0x16:
+    {
+        Modbus_WriteUint16_To_2Bytes(&buff[4],request->and_mask);
+        Modbus_WriteUint16_To_2Bytes(&buff[6],request->or_mask);
+    }
+    break;
+    case 0x17:
+    {
+        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
+        Modbus_WriteUint16_To_2Bytes(&buff[6],request->write_addr);
+        Modbus_WriteUint16_To_2Bytes(&buff[8],request->write_number);
+        buff[10]=request->write_number*2;
+        Modbus_Pack_Registers(&buff[11],request->write_registers,request->write_number);
+    }
+    break;
+    default:
+    {
+        //读取请求
+        Modbus_WriteUint16_To_2Bytes(&buff[4],number);
+    }
+    break;
+    }
+
+    if(engine->framing==MODBUS_FRAMING_TCP)
+    {
+        //单元标识及PDU不包含CRC
+        Modbus_TCP_Write_MBAP(frame_buff,engine->transaction_id,output_length-2);
+        return MODBUS_TCP_MBAP_LENGTH-1+output_length-2;
+    }
+
+    Modbus_Payload_Append_CRC(buff,output_length);
+    return output_length;
+}
+
+/*
+检查已通过CRC检查的回应并取出数据
+*/
+static modbus_master_status_t Modbus_Master_Engine_Decode(modbus_master_request_t *request,const uint8_t *buff)
+{
+    size_t number=request->number;
+
+    if(buff[0]!=request->slave_addr)
+    {
+        return MODBUS_MASTER_STATUS_INVALID_REPLY;
+    }
+
+    if(buff[1]==(request->function_code|0x80))
+    {
+        request->exception=(modbus_exception_t)buff[2];
+        return MODBUS_MASTER_STATUS_EXCEPTION;
+    }
+
+    if(buff[1]!=request->function_code)
+    {
+        return MODBUS_MASTER_STATUS_INVALID_REPLY;
+    }
+
+    switch(request->function_code)
+    {
+    case 0x01:
+    case 0x02:
+    {
+        if(buff[2]!=number/8+((number%8!=0)?1:0))
+        {
+            return MODBUS_MASTER_STATUS_INVALID_REPLY;
+        }
+        if(request->packed_bits!=NULL)
+        {
+            memcpy(request->packed_bits,&buff[3],buff[2]);
+            if(number%8!=0)
+            {
+                request->packed_bits[buff[2]-1]&=(0xFF>>(8-number%8));
+            }
+        }
+        else
+        {
+            Modbus_Unpack_Bits(request->bits,&buff[3],number);
+        }
+    }
+    break;
+    case 0x03:
+    case 0x04:
+    case 0x17:
+    {
+        if(buff[2]!=number*2)
+        {
+            return MODBUS_MASTER_STATUS_INVALID_REPLY;
+        }
+        Modbus_Unpack_Registers(request->registers,&buff[3],number);
+    }
+    break;
+    case 0x05:
+    case 0x06:
+    {
+        //回应与请求相同
+        uint16_t value=(request->function_code==0x05)?(Modbus_Master_Engine_First_Bit(request)?(0xFF00):(0x0000)):request->registers[0];
+        if(Modbus_ReadUint16_From_2Bytes(&buff[2])!=request->start_addr || Modbus_ReadUint16_From_2Bytes(&buff[4])!=value)
+        {
+            return MODBUS_MASTER_STATUS_INVALID_REPLY;
+        }
+    }
+    break;
+    case 0x16:
+    {
+        //回应与请求相同
+        if(Modbus_ReadUint16_From_2Bytes(&buff[2])!=request->start_addr || Modbus_ReadUint16_From_2Bytes(&buff[4])!=request->and_mask || Modbus_ReadUint16_From_2Bytes(&buff[6])!=request->or_mask)
+        {
+            return MODBUS_MASTER_STATUS_INVALID_REPLY;
+        }
+    }
+    break;
+    default:
+    {
+        //0x0F/0x10回应起始地址及数量
+        if(Modbus_ReadUint16_From_2Bytes(&buff[2])!=request->start_addr || Modbus_ReadUint16_From_2Bytes(&buff[4])!=number)
+        {
+            return MODBUS_MASTER_STATUS_INVALID_REPLY;
+        }
+    }
+    break;
+    }
+
+    return MODBUS_MASTER_STATUS_OK;
+}
+
+/*
+设置请求状态并调用完成回调
+*/
+static void Modbus_Master_Engine_Finish_Request(modbus_master_request_t *request,modbus_master_status_t status)
+{
+    request->status=status;
+    if(request->complete!=NULL)
+    {
+        request->complete(request);
+    }
+}
+
+/*
+结束当前请求
+*/
+static void Modbus_Master_Engine_Complete(modbus_master_engine_t *engine,modbus_master_status_t status)
+{
+    modbus_master_request_t *request=engine->current;
+    engine->current=NULL;
+    engine->rx_length=0;
+    engine->reply_length=0;
+    Modbus_Master_Engine_Finish_Request(request,status);
+}
+
+/*
+空闲时发送队列中的下一个请求
+*/
+static void Modbus_Master_Engine_Start(modbus_master_engine_t *engine,uint32_t now)
+{
+    while(engine->current==NULL && engine->head!=NULL)
+    {
+        modbus_master_request_t *request=engine->head;
+        engine->head=request->next;
+        if(engine->head==NULL)
+        {
+            engine->tail=NULL;
+        }
+        request->next=NULL;
+
+        size_t output_length=0;
+        size_t reply_length=0;
+        Modbus_Master_Engine_Frame_Lengths(engine,request,&output_length,&reply_length);
+
+        uint32_t timeout=request->timeout;
+        if(engine->policy!=NULL && reply_length!=0)
+        {
+            if(!Modbus_Master_Policy_Allow(engine->policy,request->slave_addr,now))
+            {
+                //从机熔断期间不发送
+                Modbus_Master_Engine_Finish_Request(request,MODBUS_MASTER_STATUS_SLAVE_OFFLINE);
+                continue;
+            }
+            if(timeout==0)
+            {
+                timeout=Modbus_Master_Policy_Timeout(engine->policy,request->slave_addr,request->retry);
+            }
+            modbus_slave_link_t *link=Modbus_Master_Policy_Link(engine->policy,request->slave_addr);
+            if(link!=NULL)
+            {
+                link->requests++;
+            }
+            if(engine->policy->set_timeout!=NULL)
+            {
+                engine->policy->set_timeout(engine->policy,request->slave_addr,timeout);
+            }
+        }
+
+        //每次发送(包括重试)使用新的事务标识,迟到的回应不会被当作当前请求的回应
+        engine->transaction_id++;
+        Modbus_Master_Engine_Encode(engine,request,engine->buff);
+
+        engine->current=request;
+        engine->reply_length=reply_length;
+        engine->rx_length=0;
+        Modbus_CRC_Init(&engine->crc);
+        engine->timeout=timeout;
+        engine->deadline=now+timeout;
+        request->sent_time=now;
+
+        engine->output(engine,engine->buff,output_length);
+
+        if(reply_length==0)
+        {
+            //广播请求不等待回应
+            Modbus_Master_Engine_Complete(engine,MODBUS_MASTER_STATUS_OK);
+        }
+    }
+}
+
+/*
+按策略处理当前请求的结果:超时或回应错误且未达到重试次数时重新排在队列头(以加倍的超时时间重新发送),
+否则更新从机的往返时间及熔断状态并结束当前请求。调用后需调用Modbus_Master_Engine_Start。
+*/
+static void Modbus_Master_Engine_Settle(modbus_master_engine_t *engine,modbus_master_status_t status,uint32_t now)
+{
+    modbus_master_request_t *request=engine->current;
+    modbus_master_policy_t *policy=engine->policy;
+    if(policy!=NULL)
+    {
+        modbus_slave_link_t *link=Modbus_Master_Policy_Link(policy,request->slave_addr);
+        if(status==MODBUS_MASTER_STATUS_TIMEOUT && link!=NULL)
+        {
+            link->timeouts++;
+        }
+
+        if(status==MODBUS_MASTER_STATUS_TIMEOUT || status==MODBUS_MASTER_STATUS_INVALID_REPLY)
+        {
+            if(request->retry<policy->max_retries)
+            {
+                request->retry++;
+                if(link!=NULL)
+                {
+                    link->retries++;
+                }
+                engine->current=NULL;
+                engine->rx_length=0;
+                engine->reply_length=0;
+                request->next=engine->head;
+                engine->head=request;
+                if(engine->tail==NULL)
+                {
+                    engine->tail=request;
+                }
+                return;
+            }
+            Modbus_Master_Policy_Failure(policy,request->slave_addr,now);
+        }
+        else
+        {
+            if(request->retry==0)
+            {
+                //重试过的请求无法确定回应对应哪一次发送,不作为往返时间样本
+                Modbus_Master_Policy_Sample(policy,request->slave_addr,now-request->sent_time);
+            }
+            Modbus_Master_Policy_Success(policy,request->slave_addr);
+        }
+    }
+
+    Modbus_Master_Engine_Complete(engine,status);
+}
+
+/*
+回应接收完整,检查CRC并取出数据
+*/
+static void Modbus_Master_Engine_Finish(modbus_master_engine_t *engine,uint32_t now)
+{
+    modbus_master_status_t status=MODBUS_MASTER_STATUS_INVALID_REPLY;
+    if(engine->framing==MODBUS_FRAMING_TCP)
+    {
+        //TCP不计算CRC,事务标识需与请求一致,且MBAP报文头中的长度需与PDU一致
+        uint8_t *adu=&engine->buff[MODBUS_TCP_MBAP_LENGTH-1];
+        size_t adu_length=engine->rx_length-(MODBUS_TCP_MBAP_LENGTH-1);
+        if(Modbus_ReadUint16_From_2Bytes(engine->buff)==engine->transaction_id && Modbus_RTU_Predict_Response_Length(adu,adu_length)==(int)adu_length+2)
+        {
+            status=Modbus_Master_Engine_Decode(engine->current,adu);
+        }
+    }
+    else if(engine->crc.length==engine->rx_length && Modbus_CRC_Check(&engine->crc))
+    {
+        status=Modbus_Master_Engine_Decode(engine->current,engine->buff);
+    }
+    Modbus_Master_Engine_Settle(engine,status,now);
+    Modbus_Master_Engine_Start(engine,now);
+}
+
+bool Modbus_Master_Engine_Init(modbus_master_engine_t *engine,uint8_t *buff,size_t buff_length,void (*output)(modbus_master_engine_t *engine,uint8_t *data,size_t data_length),void *usr)
+{
+    if(engine==NULL || buff==NULL || buff_length==0 || output==NULL)
+    {
+        return false;
+    }
+
+    memset(engine,0,sizeof(modbus_master_engine_t));
+    engine->buff=buff;
+    engine->buff_length=buff_length;
+    engine->output=output;
+    engine->usr=usr;
+
+    return true;
+}
+
+bool Modbus_Master_Engine_Submit(modbus_master_engine_t *engine,modbus_master_request_t *request,uint32_t now)
+{
+    if(engine==NULL || request==NULL)
+    {
+        return false;
+    }
+
+    size_t output_length=0;
+    size_t reply_length=0;
+    if(!Modbus_Master_Engine_Frame_Lengths(engine,request,&output_length,&reply_length) || output_length>engine->buff_length || reply_length>engine->buff_length)
+    {
+        request->status=MODBUS_MASTER_STATUS_INVALID_REQUEST;
+        return false;
+    }
+
+    request->status=MODBUS_MASTER_STATUS_PENDING;
+    request->exception=MODBUS_EXCEPTION_NONE;
+    request->next=NULL;
+    request->retry=0;
+    if(engine->tail!=NULL)
+    {
+        engine->tail->next=request;
+    }
+    else
+    {
+        engine->head=request;
+    }
+    engine->tail=request;
+
+    Modbus_Master_Engine_Start(engine,now);
+
+    return true;
+}
+
+size_t Modbus_Master_Engine_Feed(modbus_master_engine_t *engine,const uint8_t *data,size_t data_length,uint32_t now)
+{
+    if(engine==NULL || data==NULL || engine->current==NULL)
+    {
+        return 0;
+    }
+
+    size_t header_length=Modbus_Master_Engine_Header_Length(engine);
+    size_t used=0;
+    while(used<data_length && engine->rx_length<engine->reply_length)
+    {
+        size_t length=engine->reply_length-engine->rx_length;
+        if(engine->rx_length<header_length && length>header_length-engine->rx_length)
+        {
+            //先接收帧头(从机地址、功能码及字节数,TCP为MBAP报文头),以预测回应的实际长度
+            length=header_length-engine->rx_length;
+        }
+        if(length>data_length-used)
+        {
+            length=data_length-used;
+        }
+
+        uint8_t *rx=&engine->buff[engine->rx_length];
+        if(&data[used]!=rx)
+        {
+            memmove(rx,&data[used],length);
+        }
+        if(engine->framing!=MODBUS_FRAMING_TCP)
+        {
+            Modbus_CRC_Update(&engine->crc,rx,length);
+        }
+        engine->rx_length+=length;
+        used+=length;
+
+        if(engine->rx_length==header_length)
+        {
+            //按帧头得到回应的实际长度(异常回应为5字节),回应接收完整后立即结束,不需要等待超时
+            int predicted=(engine->framing==MODBUS_FRAMING_TCP)?Modbus_TCP_Predict_Length(engine->buff,engine->rx_length):Modbus_RTU_Predict_Response_Length(engine->buff,engine->rx_length);
+            if(predicted<0 || (size_t)predicted>engine->buff_length)
+            {
+                Modbus_Master_Engine_Settle(engine,MODBUS_MASTER_STATUS_INVALID_REPLY,now);
+                Modbus_Master_Engine_Start(engine,now);
+                return used;
+            }
+            if(predicted>0)
+            {
+                engine->reply_length=predicted;
+            }
+        }
+    }
+
+    if(engine->rx_length>=engine->reply_length)
+    {
+        Modbus_Master_Engine_Finish(engine,now);
+    }
+
+    return used;
+}
+
+bool Modbus_Master_Engine_Feed_With_CRC(modbus_master_engine_t *engine,const uint8_t *data,size_t data_length,const modbus_crc_state_t *crc,uint32_t now)
+{
+    if(engine==NULL || data==NULL || crc==NULL || engine->current==NULL || data_length<2 || engine->framing==MODBUS_FRAMING_TCP)
+    {
+        return false;
+    }
+
+    //按帧头得到回应的实际长度(异常回应为5字节)
+    int predicted=Modbus_RTU_Predict_Response_Length(data,data_length);
+    if(predicted<=0 || data_length!=(size_t)predicted || data_length>engine->buff_length)
+    {
+        return false;
+    }
+    size_t reply_length=data_length;
+
+    if(data!=engine->buff)
+    {
+        memmove(engine->buff,data,data_length);
+    }
+    engine->reply_length=reply_length;
+    engine->rx_length=data_length;
+    engine->crc=(*crc);
+
+    Modbus_Master_Engine_Finish(engine,now);
+
+    return true;
+}
+
+void Modbus_Master_Engine_Tick(modbus_master_engine_t *engine,uint32_t now)
+{
+    if(engine==NULL || engine->current==NULL || engine->timeout==0)
+    {
+        return;
+    }
+
+    if((int32_t)(now-engine->deadline)>=0)
+    {
+        Modbus_Master_Engine_Settle(engine,MODBUS_MASTER_STATUS_TIMEOUT,now);
+        Modbus_Master_Engine_Start(engine,now);
+    }
+}
+
+void Modbus_Master_Engine_Cancel(modbus_master_engine_t *engine)
+{
+    if(engine==NULL)
+    {
+        return;
+    }
+
+    //先取下所有请求,完成回调中提交的新请求不受影响
+    modbus_master_request_t *current=engine->current;
+    modbus_master_request_t *request=engine->head;
+    engine->current=NULL;
+    engine->head=NULL;
+    engine->tail=NULL;
+    engine->rx_length=0;
+    engine->reply_length=0;
+
+    if(current!=NULL)
+    {
+        Modbus_Master_Engine_Finish_Request(current,MODBUS_MASTER_STATUS_CANCELLED);
+    }
+
+    while(request!=NULL)
+    {
+        modbus_master_request_t *next=request->next;
+        request->next=NULL;
+        Modbus_Master_Engine_Finish_Request(request,MODBUS_MASTER_STATUS_CANCELLED);
+        request=next;
+    }
+}
+
+bool Modbus_Master_Engine_Busy(const modbus_master_engine_t *engine)
+{
+    if(engine==NULL)
+    {
+        return false;
+    }
+
+    return engine->current!=NULL || engine->head!=NULL;
+}
+
+uint8_t *Modbus_Master_Engine_Rx_Buffer(modbus_master_engine_t *engine,size_t *length)
+{
+    if(engine==NULL || engine->current==NULL)
+    {
+        return NULL;
+    }
+
+    if(length!=NULL)
+    {
+        (*length)=engine->reply_length-engine->rx_length;
+    }
+
+    return &engine->buff[engine->rx_length];
+}
@@ -0,0 +1,179 @@
+﻿/** \file ModbusMasterEngine.h
+ *  \brief     Modbus主机非阻塞请求引擎头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_MASTER_ENGINE_H__
+#define __MODBUS_MASTER_ENGINE_H__
+
+#include "Modbus.h"
+#include "ModbusMasterPolicy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    MODBUS_MASTER_STATUS_PENDING=0,/**< 排队中或正在等待回应 */
+    MODBUS_MASTER_STATUS_OK,/**< 成功 */
+    MODBUS_MASTER_STATUS_TIMEOUT,/**< 等待回应超时 */
+    MODBUS_MASTER_STATUS_INVALID_REPLY,/**< 回应CRC错误或格式不正确 */
+    MODBUS_MASTER_STATUS_EXCEPTION,/**< 从机回应异常,异常码见exception */
+    MODBUS_MASTER_STATUS_INVALID_REQUEST,/**< 请求参数不正确或缓冲不足 */
+    MODBUS_MASTER_STATUS_CANCELLED,/**< 已取消 */
+    MODBUS_MASTER_STATUS_SLAVE_OFFLINE/**< 从机离线(策略熔断),未发送 */
+} modbus_master_status_t/**< 请求状态 */;
+
+typedef struct modbus_master_request modbus_master_request_t;
+
+struct modbus_master_request
+{
+    uint8_t slave_addr;/**< 从机地址,为广播地址时只能写入且不等待回应(TCP的单元标识0不是广播) */
+    uint8_t function_code;/**< 功能码(0x01/0x02/0x03/0x04/0x05/0x06/0x0F/0x10/0x16/0x17) */
+    uint16_t start_addr;/**< 起始地址 */
+    size_t number;/**< 数量(0x05/0x06/0x16为1) */
+    bool *bits;/**< 线圈/输入点数据(0x01/0x02/0x05/0x0F使用) */
+    uint8_t *packed_bits;/**< 按位打包的线圈/输入点数据(低位在前,长度为(number+7)/8字节),不为NULL时代替bits */
+    uint16_t *registers;/**< 寄存器数据(0x03/0x04/0x06/0x10/0x17使用,0x17时存放读取的数据) */
+    uint16_t write_addr;/**< 写入起始地址(0x17使用,start_addr及number为读取的起始地址及数量) */
+    size_t write_number;/**< 写入数量(0x17使用) */
+    uint16_t *write_registers;/**< 写入的寄存器数据(0x17使用) */
+    uint16_t and_mask;/**< 与屏蔽(0x16使用) */
+    uint16_t or_mask;/**< 或屏蔽(0x16使用) */
+    uint32_t timeout;/**< 等待回应的超时时间(与时间戳单位相同),为0时不超时(设置了策略时按从机往返时间计算) */
+
+    /** \brief 请求完成(成功、失败或取消)时调用,可为NULL。可在此函数中提交新的请求。
+     *
+     * \param request 请求
+     *
+     */
+    void (*complete)(modbus_master_request_t *request);
+
+    void *usr;/**< 用户数据 */
+
+    modbus_master_status_t status;/**< 请求状态,不为MODBUS_MASTER_STATUS_PENDING时已完成 */
+    modbus_exception_t exception;/**< 从机回应的异常码 */
+    modbus_master_request_t *next;/**< 内部使用(请求队列) */
+    uint8_t retry;/**< 已重试次数 */
+    uint32_t sent_time;/**< 内部使用(最近一次发送的时间戳) */
+}/**< 主机请求,提交后直到完成前不能修改或释放 */;
+
+typedef struct modbus_master_engine modbus_master_engine_t;
+
+struct modbus_master_engine
+{
+    uint8_t *buff;/**< 缓冲,用于发送和接收数据 */
+    size_t buff_length;/**< 缓冲长度 */
+
+    /** \brief 输出函数,发送请求时调用,不可为NULL。
+     *
+     * \param engine 主机请求引擎
+     * \param data 输出数据的指针
+     * \param data_length 输出数据长度
+     *
+     */
+    void (*output)(modbus_master_engine_t *engine,uint8_t *data,size_t data_length);
+
+    void *usr;/**< 用户数据 */
+
+    modbus_master_policy_t *policy;/**< 超时、重试及熔断策略,可为NULL(初始化后设置)。超时或回应错误时按策略重试,从机熔断期间请求直接以MODBUS_MASTER_STATUS_SLAVE_OFFLINE完成 */
+    modbus_framing_t framing;/**< 帧格式,默认为MODBUS_FRAMING_RTU(初始化后设置)。为MODBUS_FRAMING_TCP时按MBAP帧发送(slave_addr为单元标识),不计算CRC */
+    uint16_t transaction_id;/**< 最近一次发送的事务标识(TCP,每次发送加1,回应的事务标识不一致时为回应错误) */
+
+    modbus_master_request_t *current;/**< 正在等待回应的请求 */
+    modbus_master_request_t *head;/**< 请求队列头 */
+    modbus_master_request_t *tail;/**< 请求队列尾 */
+    size_t reply_length;/**< 期望的回应长度 */
+    size_t rx_length;/**< 已接收的回应长度 */
+    modbus_crc_state_t crc;/**< 已接收回应的CRC计算状态 */
+    uint32_t timeout;/**< 当前请求的超时时间,为0时不超时 */
+    uint32_t deadline;/**< 超时时刻 */
+}/**< 主机请求引擎,每条总线一个,不阻塞等待回应,所有存储均由用户提供 */;
+
+/** \brief 初始化主机请求引擎
+ *
+ * \param engine 主机请求引擎
+ * \param buff 缓冲,用于发送和接收数据,尽量大(最大一帧为MODBUS_RTU_MAX_ADU_LENGTH)
+ * \param buff_length 缓冲长度
+ * \param output 输出函数
+ * \param usr 用户数据
+ * \return 是否成功
+ *
+ */
+bool Modbus_Master_Engine_Init(modbus_master_engine_t *engine,uint8_t *buff,size_t buff_length,void (*output)(modbus_master_engine_t *engine,uint8_t *data,size_t data_length),void *usr);
+
+/** \brief 提交请求。引擎空闲时立即发送,否则排队。
+ *
+ * \param engine 主机请求引擎
+ * \param request 请求(完成前不能修改或释放)
+ * \param now 当前时间戳
+ * \return 是否提交成功,参数不正确时返回false且请求状态为MODBUS_MASTER_STATUS_INVALID_REQUEST(不调用complete)
+ *
+ */
+bool Modbus_Master_Engine_Submit(modbus_master_engine_t *engine,modbus_master_request_t *request,uint32_t now);
+
+/** \brief 输入接收到的数据(任意长度)。
+ * 若数据已位于缓冲中的接收位置(见Modbus_Master_Engine_Rx_Buffer),则不再复制。
+ * 收到3字节帧头(TCP为6字节MBAP报文头)后按帧头预测回应的实际长度(异常回应为5字节),回应接收完整后立即完成请求。
+ * \param engine 主机请求引擎
+ * \param data 数据
+ * \param data_length 数据长度
+ * \param now 当前时间戳
+ * \return 使用的数据长度,回应完整后多余的数据及空闲时收到的数据不使用
+ *
+ */
+size_t Modbus_Master_Engine_Feed(modbus_master_engine_t *engine,const uint8_t *data,size_t data_length,uint32_t now);
+
+/** \brief 输入完整的回应及接收时已计算的CRC状态,不再遍历数据计算CRC(仅用于RTU)。
+ *
+ * \param engine 主机请求引擎
+ * \param data 整帧回应(包含CRC)
+ * \param data_length 回应长度
+ * \param crc 已并入整帧回应的CRC计算状态
+ * \param now 当前时间戳
+ * \return 是否为当前请求的完整回应
+ *
+ */
+bool Modbus_Master_Engine_Feed_With_CRC(modbus_master_engine_t *engine,const uint8_t *data,size_t data_length,const modbus_crc_state_t *crc,uint32_t now);
+
+/** \brief 定时调用,检查等待回应是否超时(设置了策略时超时后可能重新发送)
+ *
+ * \param engine 主机请求引擎
+ * \param now 当前时间戳
+ *
+ */
+void Modbus_Master_Engine_Tick(modbus_master_engine_t *engine,uint32_t now);
+
+/** \brief 取消所有请求(包括正在等待回应的请求),请求状态为MODBUS_MASTER_STATUS_CANCELLED
+ *
+ * \param engine 主机请求引擎
+ *
+ */
+void Modbus_Master_Engine_Cancel(modbus_master_engine_t *engine);
+
+/** \brief 是否正在等待回应或有请求排队
+ *
+ * \param engine 主机请求引擎
+ * \return 是否忙
+ *
+ */
+bool Modbus_Master_Engine_Busy(const modbus_master_engine_t *engine);
+
+/** \brief 获取接收位置及剩余的回应长度,可用于直接接收(如DMA)到缓冲中
+ *
+ * \param engine 主机请求引擎
+ * \param length 剩余的回应长度(收到帧头前按正常回应计算),可为NULL
+ * \return 接收位置,未等待回应时返回NULL
+ *
+ */
+uint8_t *Modbus_Master_Engine_Rx_Buffer(modbus_master_engine_t *engine,size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
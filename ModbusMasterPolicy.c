@@ -0,0 +1,171 @@
+﻿/** \file ModbusMasterPolicy.c
+ *  \brief     Modbus主机超时、重试及熔断策略(按从机测量往返时间)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusMasterPolicy.h"
+
+void Modbus_Master_Policy_Init(modbus_master_policy_t *policy,modbus_slave_link_t *links,size_t link_count)
+{
+    if(policy==NULL)
+    {
+        return;
+    }
+
+    memset(policy,0,sizeof(modbus_master_policy_t));
+    policy->links=links;
+    policy->link_count=link_count;
+    policy->initial_rto=1000;
+    policy->min_rto=10;
+    policy->max_rto=10000;
+    policy->max_retries=2;
+    policy->failure_threshold=3;
+    policy->open_time=5000;
+
+    if(links!=NULL)
+    {
+        memset(links,0,sizeof(modbus_slave_link_t)*link_count);
+    }
+}
+
+modbus_slave_link_t *Modbus_Master_Policy_Link(modbus_master_policy_t *policy,uint8_t slave_addr)
+{
+    if(policy==NULL || policy->links==NULL)
+    {
+        return NULL;
+    }
+
+    modbus_slave_link_t *free_link=NULL;
+    for(size_t i=0; i<policy->link_count; i++)
+    {
+        modbus_slave_link_t *link=&policy->links[i];
+        if(link->used && link->slave_addr==slave_addr)
+        {
+            return link;
+        }
+        if(!link->used && free_link==NULL)
+        {
+            free_link=link;
+        }
+    }
+
+    if(free_link!=NULL)
+    {
+        memset(free_link,0,sizeof(modbus_slave_link_t));
+        free_link->used=true;
+        free_link->slave_addr=slave_addr;
+        free_link->rto=policy->initial_rto;
+    }
+
+    return free_link;
+}
+
+bool Modbus_Master_Policy_Allow(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t now)
+{
+    modbus_slave_link_t *link=Modbus_Master_Policy_Link(policy,slave_addr);
+    if(link==NULL || !link->open)
+    {
+        return true;
+    }
+
+    if((int32_t)(now-link->open_until)>=0)
+    {
+        //熔断时间已过,允许试探。试探失败时重新熔断
+        return true;
+    }
+
+    link->rejected++;
+    return false;
+}
+
+uint32_t Modbus_Master_Policy_Timeout(modbus_master_policy_t *policy,uint8_t slave_addr,uint8_t retry)
+{
+    if(policy==NULL)
+    {
+        return 0;
+    }
+
+    modbus_slave_link_t *link=Modbus_Master_Policy_Link(policy,slave_addr);
+    uint64_t timeout=(link!=NULL)?link->rto:policy->initial_rto;
+    timeout<<=((retry<16)?retry:16);
+
+    if(timeout>policy->max_rto)
+    {
+        timeout=policy->max_rto;
+    }
+    if(timeout<policy->min_rto)
+    {
+        timeout=policy->min_rto;
+    }
+
+    return (uint32_t)timeout;
+}
+
+void Modbus_Master_Policy_Sample(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t rtt)
+{
+    modbus_slave_link_t *link=Modbus_Master_Policy_Link(policy,slave_addr);
+    if(link==NULL)
+    {
+        return;
+    }
+
+    //RFC 6298:SRTT=7/8*SRTT+1/8*R,RTTVAR=3/4*RTTVAR+1/4*|SRTT-R|,RTO=SRTT+4*RTTVAR
+    if(!link->measured)
+    {
+        link->srtt=rtt<<3;
+        link->rttvar=rtt<<1;
+        link->measured=true;
+    }
+    else
+    {
+        int32_t err=(int32_t)rtt-(int32_t)(link->srtt>>3);
+        link->srtt=(uint32_t)((int32_t)link->srtt+err);
+        if(err<0)
+        {
+            err=-err;
+        }
+        link->rttvar=(uint32_t)((int32_t)link->rttvar+err-(int32_t)(link->rttvar>>2));
+    }
+
+    uint64_t rto=(uint64_t)(link->srtt>>3)+link->rttvar;
+    if(rto<policy->min_rto)
+    {
+        rto=policy->min_rto;
+    }
+    if(rto>policy->max_rto)
+    {
+        rto=policy->max_rto;
+    }
+    link->rto=(uint32_t)rto;
+}
+
+void Modbus_Master_Policy_Success(modbus_master_policy_t *policy,uint8_t slave_addr)
+{
+    modbus_slave_link_t *link=Modbus_Master_Policy_Link(policy,slave_addr);
+    if(link==NULL)
+    {
+        return;
+    }
+
+    link->failures=0;
+    link->open=false;
+}
+
+void Modbus_Master_Policy_Failure(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t now)
+{
+    modbus_slave_link_t *link=Modbus_Master_Policy_Link(policy,slave_addr);
+    if(link==NULL)
+    {
+        return;
+    }
+
+    link->failures++;
+    if(link->open || (policy->failure_threshold!=0 && link->failures>=policy->failure_threshold))
+    {
+        link->open=true;
+        link->open_until=now+policy->open_time;
+    }
+}
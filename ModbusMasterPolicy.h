@@ -0,0 +1,136 @@
+﻿/** \file ModbusMasterPolicy.h
+ *  \brief     Modbus主机超时、重试及熔断策略(按从机测量往返时间)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_MASTER_POLICY_H__
+#define __MODBUS_MASTER_POLICY_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    uint8_t slave_addr;/**< 从机地址 */
+    bool used;/**< 是否已分配给从机(第一次请求时自动分配) */
+    bool measured;/**< 是否已有往返时间样本 */
+    uint32_t srtt;/**< 平滑往返时间(8倍) */
+    uint32_t rttvar;/**< 往返时间偏差(4倍) */
+    uint32_t rto;/**< 当前超时时间 */
+    uint32_t failures;/**< 连续失败(重试后仍超时或回应错误)次数 */
+    bool open;/**< 熔断(从机离线),熔断期间的请求不发送 */
+    uint32_t open_until;/**< 熔断结束时刻,之后允许发送一个试探请求 */
+
+    uint32_t requests;/**< 统计:发送次数(包含重试) */
+    uint32_t timeouts;/**< 统计:超时次数 */
+    uint32_t retries;/**< 统计:重试次数 */
+    uint32_t rejected;/**< 统计:熔断期间未发送的请求数量 */
+} modbus_slave_link_t/**< 单个从机的往返时间及状态 */;
+
+struct modbus_master_policy
+{
+    modbus_slave_link_t *links;/**< 从机状态数组(由用户定义),数组已满时其余从机使用initial_rto且不熔断 */
+    size_t link_count;/**< 从机状态数组长度 */
+
+    uint32_t initial_rto;/**< 没有往返时间样本时的超时时间 */
+    uint32_t min_rto;/**< 最小超时时间 */
+    uint32_t max_rto;/**< 最大超时时间(包含重试退避) */
+    uint8_t max_retries;/**< 超时或回应错误时的最大重试次数,每次重试超时时间加倍 */
+    uint32_t failure_threshold;/**< 连续失败多少次后熔断 */
+    uint32_t open_time;/**< 熔断持续时间 */
+
+    /** \brief 获取当前时间(与超时时间单位相同),可为NULL。阻塞模式(modbus_master_context_t)用于测量往返时间,为NULL时阻塞模式不使用策略。
+     *
+     * \param policy 策略
+     * \return 当前时间
+     *
+     */
+    uint32_t (*get_time)(modbus_master_policy_t *policy);
+
+    /** \brief 发送请求前调用,可为NULL。阻塞模式下用于设置request_reply等待回应的超时时间。
+     *
+     * \param policy 策略
+     * \param slave_addr 从机地址
+     * \param timeout 超时时间
+     *
+     */
+    void (*set_timeout)(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t timeout);
+
+    void *usr;/**< 用户数据 */
+};
+
+/** \brief 初始化策略(时间单位为ms时的默认值:初始超时1000,超时范围10~10000,重试2次,连续失败3次后熔断5000)
+ *
+ * \param policy 策略
+ * \param links 从机状态数组
+ * \param link_count 从机状态数组长度
+ *
+ */
+void Modbus_Master_Policy_Init(modbus_master_policy_t *policy,modbus_slave_link_t *links,size_t link_count);
+
+/** \brief 查找从机状态,不存在时分配一个
+ *
+ * \param policy 策略
+ * \param slave_addr 从机地址
+ * \return 从机状态,数组已满时返回NULL
+ *
+ */
+modbus_slave_link_t *Modbus_Master_Policy_Link(modbus_master_policy_t *policy,uint8_t slave_addr);
+
+/** \brief 是否允许向从机发送请求(未熔断,或熔断时间已过允许试探)
+ *
+ * \param policy 策略
+ * \param slave_addr 从机地址
+ * \param now 当前时间
+ * \return 是否允许
+ *
+ */
+bool Modbus_Master_Policy_Allow(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t now);
+
+/** \brief 计算超时时间(往返时间+4倍偏差,第n次重试乘以2^n)
+ *
+ * \param policy 策略
+ * \param slave_addr 从机地址
+ * \param retry 重试次数(第一次发送为0)
+ * \return 超时时间
+ *
+ */
+uint32_t Modbus_Master_Policy_Timeout(modbus_master_policy_t *policy,uint8_t slave_addr,uint8_t retry);
+
+/** \brief 记录一次往返时间样本(仅使用未重试的请求)并更新超时时间
+ *
+ * \param policy 策略
+ * \param slave_addr 从机地址
+ * \param rtt 往返时间
+ *
+ */
+void Modbus_Master_Policy_Sample(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t rtt);
+
+/** \brief 记录从机已回应(包括异常回应),清除连续失败次数并结束熔断
+ *
+ * \param policy 策略
+ * \param slave_addr 从机地址
+ *
+ */
+void Modbus_Master_Policy_Success(modbus_master_policy_t *policy,uint8_t slave_addr);
+
+/** \brief 记录一次失败(重试后仍超时或回应错误),连续失败达到阈值或试探失败时熔断
+ *
+ * \param policy 策略
+ * \param slave_addr 从机地址
+ * \param now 当前时间
+ *
+ */
+void Modbus_Master_Policy_Failure(modbus_master_policy_t *policy,uint8_t slave_addr,uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,253 @@
+﻿/** \file ModbusPack.c
+ *  \brief     Modbus数据打包/解包(线圈位图及寄存器字节序)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusPack.h"
+
+/*
+向量指令要求bool占1字节(值为0或1),按编译配置选择(不在运行时检测CPU)。
+*/
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MODBUS_PACK_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#define MODBUS_PACK_SSE2 1
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <tmmintrin.h>
+#define MODBUS_PACK_SSSE3 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MODBUS_PACK_NEON 1
+#endif
+
+/*
+小端模式下寄存器与帧数据之间只需交换每个16位数据的两个字节
+*/
+#if (defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__) || defined(_MSC_VER)
+#define MODBUS_PACK_LITTLE_ENDIAN 1
+#elif defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+#define MODBUS_PACK_BIG_ENDIAN 1
+#endif
+
+void Modbus_Pack_Bits(uint8_t *packed,const bool *bits,size_t number)
+{
+    if(packed==NULL || bits==NULL)
+    {
+        return;
+    }
+
+    size_t i=0;
+
+#ifdef MODBUS_PACK_AVX2
+    for(; i+32<=number; i+=32)
+    {
+        __m256i v=_mm256_loadu_si256((const __m256i *)&bits[i]);
+        uint32_t mask=~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_setzero_si256()));
+        packed[i/8]=(uint8_t)mask;
+        packed[i/8+1]=(uint8_t)(mask>>8);
+        packed[i/8+2]=(uint8_t)(mask>>16);
+        packed[i/8+3]=(uint8_t)(mask>>24);
+    }
+#endif
+
+#ifdef MODBUS_PACK_SSE2
+    for(; i+16<=number; i+=16)
+    {
+        __m128i v=_mm_loadu_si128((const __m128i *)&bits[i]);
+        uint32_t mask=~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_setzero_si128()));
+        packed[i/8]=(uint8_t)mask;
+        packed[i/8+1]=(uint8_t)(mask>>8);
+    }
+#endif
+
+    for(; i+8<=number; i+=8)
+    {
+        const bool *src=&bits[i];
+        packed[i/8]=(uint8_t)((src[0]?0x01:0)|(src[1]?0x02:0)|(src[2]?0x04:0)|(src[3]?0x08:0)|(src[4]?0x10:0)|(src[5]?0x20:0)|(src[6]?0x40:0)|(src[7]?0x80:0));
+    }
+
+    if(i<number)
+    {
+        //最后不足8个,多余的位填0
+        uint8_t byte=0;
+        for(size_t k=0; i+k<number; k++)
+        {
+            if(bits[i+k])
+            {
+                byte|=(0x01<<k);
+            }
+        }
+        packed[i/8]=byte;
+    }
+}
+
+void Modbus_Unpack_Bits(bool *bits,const uint8_t *packed,size_t number)
+{
+    if(bits==NULL || packed==NULL)
+    {
+        return;
+    }
+
+    size_t i=0;
+
+#ifdef MODBUS_PACK_AVX2
+    {
+        //每个字节复制到8个字节中,再与各自的位比较
+        const __m256i shuffle=_mm256_setr_epi8(0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,2,2,2,2,2,2,2,2,3,3,3,3,3,3,3,3);
+        const __m256i select=_mm256_setr_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128);
+        const __m256i one=_mm256_set1_epi8(1);
+        for(; i+32<=number; i+=32)
+        {
+            const uint8_t *src=&packed[i/8];
+            uint32_t word=(uint32_t)src[0]|((uint32_t)src[1]<<8)|((uint32_t)src[2]<<16)|((uint32_t)src[3]<<24);
+            __m256i v=_mm256_shuffle_epi8(_mm256_set1_epi32((int32_t)word),shuffle);
+            v=_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v,select),select),one);
+            _mm256_storeu_si256((__m256i *)&bits[i],v);
+        }
+    }
+#endif
+
+#ifdef MODBUS_PACK_SSE2
+    {
+        const __m128i select=_mm_setr_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128);
+        const __m128i one=_mm_set1_epi8(1);
+        for(; i+16<=number; i+=16)
+        {
+            const uint8_t *src=&packed[i/8];
+            __m128i v=_mm_cvtsi32_si128((int)((uint32_t)src[0]|((uint32_t)src[1]<<8)));
+            //b0 b1 -> b0 b0 b1 b1 -> b0*4 b1*4 -> b0*8 b1*8
+            v=_mm_unpacklo_epi8(v,v);
+            v=_mm_unpacklo_epi16(v,v);
+            v=_mm_unpacklo_epi32(v,v);
+            v=_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v,select),select),one);
+            _mm_storeu_si128((__m128i *)&bits[i],v);
+        }
+    }
+#endif
+
+    for(; i+8<=number; i+=8)
+    {
+        uint8_t byte=packed[i/8];
+        bool *dst=&bits[i];
+        dst[0]=(byte&0x01)!=0;
+        dst[1]=(byte&0x02)!=0;
+        dst[2]=(byte&0x04)!=0;
+        dst[3]=(byte&0x08)!=0;
+        dst[4]=(byte&0x10)!=0;
+        dst[5]=(byte&0x20)!=0;
+        dst[6]=(byte&0x40)!=0;
+        dst[7]=(byte&0x80)!=0;
+    }
+
+    if(i<number)
+    {
+        uint8_t byte=packed[i/8];
+        for(size_t k=0; i+k<number; k++)
+        {
+            bits[i+k]=(byte&(0x01<<k))!=0;
+        }
+    }
+}
+
+#ifdef MODBUS_PACK_LITTLE_ENDIAN
+/*
+交换每个16位数据的两个字节,dst与src可以相同
+*/
+static void Modbus_Pack_Swap_16(uint8_t *dst,const uint8_t *src,size_t number)
+{
+    size_t i=0;
+
+#ifdef MODBUS_PACK_AVX2
+    {
+        const __m256i shuffle=_mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+        for(; i+16<=number; i+=16)
+        {
+            __m256i v=_mm256_loadu_si256((const __m256i *)&src[2*i]);
+            _mm256_storeu_si256((__m256i *)&dst[2*i],_mm256_shuffle_epi8(v,shuffle));
+        }
+    }
+#endif
+
+#if defined(MODBUS_PACK_SSSE3)
+    {
+        const __m128i shuffle=_mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+        for(; i+8<=number; i+=8)
+        {
+            __m128i v=_mm_loadu_si128((const __m128i *)&src[2*i]);
+            _mm_storeu_si128((__m128i *)&dst[2*i],_mm_shuffle_epi8(v,shuffle));
+        }
+    }
+#elif defined(MODBUS_PACK_SSE2)
+    for(; i+8<=number; i+=8)
+    {
+        __m128i v=_mm_loadu_si128((const __m128i *)&src[2*i]);
+        _mm_storeu_si128((__m128i *)&dst[2*i],_mm_or_si128(_mm_slli_epi16(v,8),_mm_srli_epi16(v,8)));
+    }
+#elif defined(MODBUS_PACK_NEON)
+    for(; i+8<=number; i+=8)
+    {
+        vst1q_u8(&dst[2*i],vrev16q_u8(vld1q_u8(&src[2*i])));
+    }
+#endif
+
+    for(; i<number; i++)
+    {
+        uint8_t high=src[2*i+1];
+        dst[2*i+1]=src[2*i];
+        dst[2*i]=high;
+    }
+}
+#endif
+
+void Modbus_Pack_Registers(uint8_t *data,const uint16_t *registers,size_t number)
+{
+    if(data==NULL || registers==NULL)
+    {
+        return;
+    }
+
+#if defined(MODBUS_PACK_LITTLE_ENDIAN)
+    Modbus_Pack_Swap_16(data,(const uint8_t *)registers,number);
+#elif defined(MODBUS_PACK_BIG_ENDIAN)
+    memmove(data,registers,2*number);
+#else
+    for(size_t i=0; i<number; i++)
+    {
+        //modbus的16位数据高字节在前,低字节在后
+        uint16_t value=registers[i];
+        data[2*i]=(value>>8);
+        data[2*i+1]=(value&0xff);
+    }
+#endif
+}
+
+void Modbus_Unpack_Registers(uint16_t *registers,const uint8_t *data,size_t number)
+{
+    if(registers==NULL || data==NULL)
+    {
+        return;
+    }
+
+#if defined(MODBUS_PACK_LITTLE_ENDIAN)
+    Modbus_Pack_Swap_16((uint8_t *)registers,data,number);
+#elif defined(MODBUS_PACK_BIG_ENDIAN)
+    memmove(registers,data,2*number);
+#else
+    for(size_t i=0; i<number; i++)
+    {
+        //modbus的16位数据高字节在前,低字节在后
+        registers[i]=(((uint16_t)data[2*i])<<8)|data[2*i+1];
+    }
+#endif
+}
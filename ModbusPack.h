@@ -0,0 +1,65 @@
+﻿/** \file ModbusPack.h
+ *  \brief     Modbus数据打包/解包(线圈位图及寄存器字节序)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_PACK_H__
+#define __MODBUS_PACK_H__
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "stdlib.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \brief 将bool数组打包为位图(低位在前,与Modbus帧中的线圈数据相同),最后一个字节多余的位填0。
+ * 编译时启用AVX2/SSE2时使用向量指令,否则每次处理8个元素。
+ *
+ * \param packed 位图,长度为(number+7)/8字节
+ * \param bits bool数组
+ * \param number 数量
+ *
+ */
+void Modbus_Pack_Bits(uint8_t *packed,const bool *bits,size_t number);
+
+/** \brief 将位图(低位在前)解包为bool数组。
+ * 编译时启用AVX2/SSE2时使用向量指令,否则每次处理8个元素。
+ *
+ * \param bits bool数组
+ * \param packed 位图,长度为(number+7)/8字节
+ * \param number 数量
+ *
+ */
+void Modbus_Unpack_Bits(bool *bits,const uint8_t *packed,size_t number);
+
+/** \brief 将寄存器数组转换为帧中的数据(高字节在前)。
+ * 编译时启用AVX2/SSSE3/SSE2/NEON时使用向量指令交换字节。
+ *
+ * \param data 帧数据,长度为2*number字节,可以与registers指向同一地址(原地转换)
+ * \param registers 寄存器数组
+ * \param number 寄存器数量
+ *
+ */
+void Modbus_Pack_Registers(uint8_t *data,const uint16_t *registers,size_t number);
+
+/** \brief 将帧中的数据(高字节在前)转换为寄存器数组。
+ * 编译时启用AVX2/SSSE3/SSE2/NEON时使用向量指令交换字节。
+ *
+ * \param registers 寄存器数组,可以与data指向同一地址(原地转换)
+ * \param data 帧数据,长度为2*number字节
+ * \param number 寄存器数量
+ *
+ */
+void Modbus_Unpack_Registers(uint16_t *registers,const uint8_t *data,size_t number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
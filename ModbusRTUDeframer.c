@@ -0,0 +1,322 @@
+﻿/** \file ModbusRTUDeframer.c
+ *  \brief     Modbus RTU模式下字节流分帧C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusRTUDeframer.h"
+
+/*
+帧的最小长度:从机地址+功能码+CRC
+*/
+#define MODBUS_RTU_MIN_ADU_LENGTH 4
+
+void Modbus_RTU_Deframer_Init(modbus_rtu_deframer_t *deframer,modbus_rtu_deframer_direction_t direction,uint32_t char_time,uint32_t t15,uint32_t t35)
+{
+    if(deframer==NULL)
+    {
+        return;
+    }
+
+    memset(deframer,0,sizeof(modbus_rtu_deframer_t));
+    deframer->direction=direction;
+    deframer->char_time=char_time;
+    deframer->t15=t15;
+    deframer->t35=t35;
+}
+
+void Modbus_RTU_Deframer_Reset(modbus_rtu_deframer_t *deframer)
+{
+    if(deframer==NULL)
+    {
+        return;
+    }
+
+    deframer->head=0;
+    deframer->count=0;
+    deframer->gap_count=0;
+    deframer->has_timestamp=false;
+}
+
+/*
+读取环形缓冲中第index个字节
+*/
+static uint8_t Modbus_RTU_Deframer_Byte(modbus_rtu_deframer_t *deframer,size_t index)
+{
+    index+=deframer->head;
+    if(index>=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH)
+    {
+        index-=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH;
+    }
+    return deframer->buffer[index];
+}
+
+/*
+从环形缓冲头部丢弃length个字节
+*/
+static void Modbus_RTU_Deframer_Consume(modbus_rtu_deframer_t *deframer,size_t length)
+{
+    deframer->head+=length;
+    if(deframer->head>=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH)
+    {
+        deframer->head-=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH;
+    }
+    deframer->count-=length;
+    deframer->read_pos+=length;
+
+    //删除已经越过的帧间隔
+    size_t i=0;
+    while(i<deframer->gap_count && (int32_t)(deframer->gaps[i]-deframer->read_pos)<=0)
+    {
+        i++;
+    }
+    if(i>0)
+    {
+        memmove(&deframer->gaps[0],&deframer->gaps[i],(deframer->gap_count-i)*sizeof(deframer->gaps[0]));
+        deframer->gap_count-=i;
+    }
+}
+
+/*
+计算环形缓冲头部length个字节(包含CRC)的CRC是否通过
+*/
+static bool Modbus_RTU_Deframer_Check_CRC(modbus_rtu_deframer_t *deframer,size_t length)
+{
+    modbus_crc_state_t crc;
+    Modbus_CRC_Init(&crc);
+    size_t first=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH-deframer->head;
+    if(first>=length)
+    {
+        Modbus_CRC_Update(&crc,&deframer->buffer[deframer->head],length);
+    }
+    else
+    {
+        Modbus_CRC_Update(&crc,&deframer->buffer[deframer->head],first);
+        Modbus_CRC_Update(&crc,&deframer->buffer[0],length-first);
+    }
+    return Modbus_CRC_Check(&crc);
+}
+
+/*
+CRC搜索:查找环形缓冲头部能通过CRC检查的帧长度,未找到返回0。
+closed为真时数据已完整,返回最长的帧长度;否则返回最短的帧长度。
+由于CRC余数为0后再并入0x00余数仍为0,最短的帧长度后紧跟0x00时不能区分,
+此时若0x00开始的数据不是一帧完整的广播帧,则将0x00并入当前帧。
+*/
+static size_t Modbus_RTU_Deframer_Search_CRC(modbus_rtu_deframer_t *deframer,size_t limit,bool closed)
+{
+    modbus_crc_state_t crc;
+    Modbus_CRC_Init(&crc);
+    size_t length=0;
+    for(size_t i=0; i<limit; i++)
+    {
+        uint8_t data=Modbus_RTU_Deframer_Byte(deframer,i);
+        if(length!=0 && !closed)
+        {
+            if(data!=0x00)
+            {
+                break;
+            }
+            uint8_t header[11];
+            size_t header_length=limit-i;
+            if(header_length>sizeof(header))
+            {
+                header_length=sizeof(header);
+            }
+            for(size_t j=0; j<header_length; j++)
+            {
+                header[j]=Modbus_RTU_Deframer_Byte(deframer,i+j);
+            }
+            int predict=(deframer->direction==MODBUS_RTU_DEFRAMER_REQUEST)?Modbus_RTU_Predict_Request_Length(header,header_length):Modbus_RTU_Predict_Response_Length(header,header_length);
+            if(predict>=MODBUS_RTU_MIN_ADU_LENGTH && i+predict<=limit)
+            {
+                //0x00开始的数据为一帧完整的广播帧
+                break;
+            }
+        }
+        Modbus_CRC_Update(&crc,&data,1);
+        if(i+1>=MODBUS_RTU_MIN_ADU_LENGTH && Modbus_CRC_Check(&crc))
+        {
+            length=i+1;
+        }
+    }
+    return length;
+}
+
+size_t Modbus_RTU_Deframer_Feed(modbus_rtu_deframer_t *deframer,const uint8_t *data,size_t data_length,uint32_t timestamp)
+{
+    if(deframer==NULL || data==NULL || data_length==0)
+    {
+        return 0;
+    }
+
+    size_t length=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH-deframer->count;
+    if(length>data_length)
+    {
+        length=data_length;
+    }
+    if(length==0)
+    {
+        return 0;
+    }
+
+    if(deframer->char_time!=0 && deframer->has_timestamp && deframer->count>0)
+    {
+        //计算本段数据第一个字节之前的静默时间
+        uint32_t first_timestamp=timestamp-(uint32_t)(length-1)*deframer->char_time;
+        int32_t silence=(int32_t)(first_timestamp-deframer->last_timestamp)-(int32_t)deframer->char_time;
+        bool gap=false;
+        if(deframer->t35!=0 && silence>(int32_t)deframer->t35)
+        {
+            gap=true;
+        }
+        else if(deframer->t15!=0 && silence>(int32_t)deframer->t15)
+        {
+            //帧内字符间隔超过t1.5,按协议此帧无效
+            deframer->t15_errors++;
+            gap=true;
+        }
+
+        if(gap)
+        {
+            if(deframer->gap_count>=MODBUS_RTU_DEFRAMER_MAX_GAPS)
+            {
+                deframer->gap_count=MODBUS_RTU_DEFRAMER_MAX_GAPS-1;
+            }
+            deframer->gaps[deframer->gap_count++]=deframer->read_pos+deframer->count;
+        }
+    }
+
+    size_t tail=deframer->head+deframer->count;
+    if(tail>=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH)
+    {
+        tail-=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH;
+    }
+    size_t first=MODBUS_RTU_DEFRAMER_BUFFER_LENGTH-tail;
+    if(first>=length)
+    {
+        memcpy(&deframer->buffer[tail],data,length);
+    }
+    else
+    {
+        memcpy(&deframer->buffer[tail],data,first);
+        memcpy(&deframer->buffer[0],&data[first],length-first);
+    }
+    deframer->count+=length;
+
+    deframer->last_timestamp=timestamp;
+    deframer->has_timestamp=true;
+
+    return length;
+}
+
+size_t Modbus_RTU_Deframer_Poll(modbus_rtu_deframer_t *deframer,uint32_t now,uint8_t *frame,size_t frame_length)
+{
+    if(deframer==NULL || frame==NULL)
+    {
+        return 0;
+    }
+
+    while(deframer->count>0)
+    {
+        //帧不能跨越帧间隔,帧间隔之前的数据已完整
+        size_t limit=deframer->count;
+        bool closed=false;
+        if(deframer->gap_count>0)
+        {
+            limit=deframer->gaps[0]-deframer->read_pos;
+            closed=true;
+        }
+        else if(deframer->char_time!=0 && deframer->t35!=0 && deframer->has_timestamp && (now-deframer->last_timestamp)>deframer->t35)
+        {
+            //线路已空闲t3.5
+            closed=true;
+        }
+        if(limit>MODBUS_RTU_MAX_ADU_LENGTH)
+        {
+            limit=MODBUS_RTU_MAX_ADU_LENGTH;
+            closed=true;
+        }
+
+        uint8_t header[11];
+        size_t header_length=(limit<sizeof(header))?limit:sizeof(header);
+        for(size_t i=0; i<header_length; i++)
+        {
+            header[i]=Modbus_RTU_Deframer_Byte(deframer,i);
+        }
+
+        int predict=(deframer->direction==MODBUS_RTU_DEFRAMER_REQUEST)?Modbus_RTU_Predict_Request_Length(header,header_length):Modbus_RTU_Predict_Response_Length(header,header_length);
+
+        size_t length=0;
+        if(predict>=MODBUS_RTU_MIN_ADU_LENGTH && predict<=MODBUS_RTU_MAX_ADU_LENGTH)
+        {
+            if((size_t)predict<=limit)
+            {
+                if(Modbus_RTU_Deframer_Check_CRC(deframer,predict))
+                {
+                    length=predict;
+                }
+                else
+                {
+                    //长度正确但CRC错误,通过CRC搜索重新同步(可能是另一方向的帧)
+                    length=Modbus_RTU_Deframer_Search_CRC(deframer,limit,closed);
+                }
+            }
+            else if(!closed)
+            {
+                //等待更多数据
+                return 0;
+            }
+            else
+            {
+                length=Modbus_RTU_Deframer_Search_CRC(deframer,limit,closed);
+            }
+        }
+        else if(predict==0 && !closed)
+        {
+            //等待更多数据
+            return 0;
+        }
+        else if(predict<0 && !closed && deframer->char_time!=0 && deframer->t35!=0)
+        {
+            //未知功能码,等待t3.5空闲后再确定帧长度
+            return 0;
+        }
+        else
+        {
+            //未知功能码或长度不正确,通过CRC搜索确定帧长度
+            length=Modbus_RTU_Deframer_Search_CRC(deframer,limit,closed);
+            if(length==0 && predict<0 && !closed)
+            {
+                return 0;
+            }
+        }
+
+        if(length==0)
+        {
+            //无法组成帧,丢弃一个字节后重新同步
+            Modbus_RTU_Deframer_Consume(deframer,1);
+            deframer->dropped_bytes++;
+            continue;
+        }
+
+        if(length>frame_length)
+        {
+            Modbus_RTU_Deframer_Consume(deframer,length);
+            deframer->dropped_bytes+=length;
+            continue;
+        }
+
+        for(size_t i=0; i<length; i++)
+        {
+            frame[i]=Modbus_RTU_Deframer_Byte(deframer,i);
+        }
+        Modbus_RTU_Deframer_Consume(deframer,length);
+        deframer->frames++;
+        return length;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+﻿/** \file ModbusRTUDeframer.h
+ *  \brief     Modbus RTU模式下字节流分帧头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_RTU_DEFRAMER_H__
+#define __MODBUS_RTU_DEFRAMER_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+环形缓冲长度,至少需要能存放一帧完整的数据,可在编译时重新定义。
+*/
+#ifndef MODBUS_RTU_DEFRAMER_BUFFER_LENGTH
+#define MODBUS_RTU_DEFRAMER_BUFFER_LENGTH (MODBUS_RTU_MAX_ADU_LENGTH*2)
+#endif
+
+/*
+最多记录的帧间隔(t3.5)数量
+*/
+#ifndef MODBUS_RTU_DEFRAMER_MAX_GAPS
+#define MODBUS_RTU_DEFRAMER_MAX_GAPS 16
+#endif
+
+typedef enum
+{
+    MODBUS_RTU_DEFRAMER_REQUEST=0,/**< 分帧请求帧(从机使用) */
+    MODBUS_RTU_DEFRAMER_RESPONSE,/**< 分帧回应帧(主机使用) */
+} modbus_rtu_deframer_direction_t/**< 分帧方向 */;
+
+typedef struct
+{
+    uint8_t buffer[MODBUS_RTU_DEFRAMER_BUFFER_LENGTH];/**< 环形缓冲 */
+    size_t head;/**< 环形缓冲中第一个字节的下标 */
+    size_t count;/**< 环形缓冲中的字节数 */
+    uint32_t read_pos;/**< 环形缓冲中第一个字节在字节流中的位置 */
+
+    uint32_t gaps[MODBUS_RTU_DEFRAMER_MAX_GAPS];/**< 帧间隔(字节流位置),帧不能跨越帧间隔 */
+    size_t gap_count;/**< 帧间隔数量 */
+
+    modbus_rtu_deframer_direction_t direction;/**< 分帧方向 */
+    uint32_t char_time;/**< 单个字符的传输时间(us),为0时不进行时序检查 */
+    uint32_t t15;/**< t1.5(us),为0时不检查字符间隔 */
+    uint32_t t35;/**< t3.5(us),为0时只通过长度与CRC分帧 */
+    uint32_t last_timestamp;/**< 最后一个字节的接收时间(us) */
+    bool has_timestamp;/**< last_timestamp是否有效 */
+
+    size_t dropped_bytes;/**< 统计:丢弃的字节数 */
+    size_t t15_errors;/**< 统计:帧内字符间隔超过t1.5的次数 */
+    size_t frames;/**< 统计:输出的帧数 */
+} modbus_rtu_deframer_t/**< 分帧器,所有存储均在结构体内,不使用动态内存 */;
+
+/** \brief 初始化分帧器
+ *
+ * \param deframer 分帧器
+ * \param direction 分帧方向,从机使用MODBUS_RTU_DEFRAMER_REQUEST,主机使用MODBUS_RTU_DEFRAMER_RESPONSE
+ * \param char_time 单个字符的传输时间(us),为0时不进行时序检查
+ * \param t15 t1.5(us)
+ * \param t35 t3.5(us)
+ *
+ */
+void Modbus_RTU_Deframer_Init(modbus_rtu_deframer_t *deframer,modbus_rtu_deframer_direction_t direction,uint32_t char_time,uint32_t t15,uint32_t t35);
+
+/** \brief 清空分帧器中的数据(保留配置)
+ *
+ * \param deframer 分帧器
+ *
+ */
+void Modbus_RTU_Deframer_Reset(modbus_rtu_deframer_t *deframer);
+
+/** \brief 输入接收到的数据(任意长度)
+ *
+ * \param deframer 分帧器
+ * \param data 数据指针
+ * \param data_length 数据长度
+ * \param timestamp 最后一个字节的接收时间(us,允许回绕)
+ * \return size_t 已接受的数据长度,小于data_length时表示缓冲已满,需先调用Modbus_RTU_Deframer_Poll取出数据
+ *
+ */
+size_t Modbus_RTU_Deframer_Feed(modbus_rtu_deframer_t *deframer,const uint8_t *data,size_t data_length,uint32_t timestamp);
+
+/** \brief 取出一帧完整的数据(已通过CRC检查)
+ * 可多次调用直到返回0。无法组成帧的数据(噪声)将通过CRC搜索重新同步后丢弃。
+ * \param deframer 分帧器
+ * \param now 当前时间(us),用于判断t3.5空闲
+ * \param frame 帧缓冲
+ * \param frame_length 帧缓冲长度,推荐MODBUS_RTU_MAX_ADU_LENGTH
+ * \return size_t 帧长度(包含CRC),0表示暂无完整的帧
+ *
+ */
+size_t Modbus_RTU_Deframer_Poll(modbus_rtu_deframer_t *deframer,uint32_t now,uint8_t *frame,size_t frame_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
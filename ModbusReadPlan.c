@@ -0,0 +1,221 @@
+﻿/** \file ModbusReadPlan.c
+ *  \brief     Modbus主机读取计划(合并零散的读取)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusReadPlan.h"
+
+static bool Modbus_Read_Plan_Is_Bits(modbus_table_t table)
+{
+    return table==MODBUS_TABLE_IX || table==MODBUS_TABLE_OX;
+}
+
+/*
+比较标签的顺序(先按从机地址,再按表,最后按起始地址)
+*/
+static bool Modbus_Read_Tag_Less(const modbus_read_tag_t *a,const modbus_read_tag_t *b)
+{
+    if(a->slave_addr!=b->slave_addr)
+    {
+        return a->slave_addr<b->slave_addr;
+    }
+    if(a->table!=b->table)
+    {
+        return a->table<b->table;
+    }
+    return a->addr<b->addr;
+}
+
+/*
+检查地址范围[start,end)是否与禁止读取的地址范围重叠
+*/
+static bool Modbus_Read_Plan_Hits_Hole(const modbus_read_plan_t *plan,uint8_t slave_addr,modbus_table_t table,size_t start,size_t end)
+{
+    if(plan->holes==NULL || start>=end)
+    {
+        return false;
+    }
+
+    for(size_t i=0; i<plan->hole_count; i++)
+    {
+        const modbus_read_hole_t *hole=&plan->holes[i];
+        if(hole->slave_addr==slave_addr && hole->table==table && hole->addr<end && start<(size_t)hole->addr+hole->number)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Modbus_Read_Plan_Init(modbus_read_plan_t *plan,modbus_read_tag_t *tags,size_t tag_count,modbus_read_request_t *requests,size_t request_capacity)
+{
+    if(plan==NULL)
+    {
+        return;
+    }
+
+    memset(plan,0,sizeof(modbus_read_plan_t));
+    plan->tags=tags;
+    plan->tag_count=tag_count;
+    plan->max_bits=MODBUS_MAX_READ_BITS;
+    plan->max_registers=MODBUS_MAX_READ_REGISTERS;
+    plan->requests=requests;
+    plan->request_capacity=request_capacity;
+}
+
+bool Modbus_Read_Plan_Build(modbus_read_plan_t *plan)
+{
+    if(plan==NULL || (plan->tags==NULL && plan->tag_count!=0) || (plan->requests==NULL && plan->request_capacity!=0))
+    {
+        return false;
+    }
+
+    plan->request_count=0;
+
+    //插入排序(标签数组通常只在启动时生成一次计划)
+    modbus_read_tag_t *tags=plan->tags;
+    for(size_t i=1; i<plan->tag_count; i++)
+    {
+        modbus_read_tag_t tag=tags[i];
+        size_t j=i;
+        while(j>0 && Modbus_Read_Tag_Less(&tag,&tags[j-1]))
+        {
+            tags[j]=tags[j-1];
+            j--;
+        }
+        tags[j]=tag;
+    }
+
+    modbus_read_request_t *request=NULL;
+    for(size_t i=0; i<plan->tag_count; i++)
+    {
+        modbus_read_tag_t *tag=&tags[i];
+        bool bits=Modbus_Read_Plan_Is_Bits(tag->table);
+        size_t max_number=bits?plan->max_bits:plan->max_registers;
+        size_t max_gap=bits?plan->max_gap_bits:plan->max_gap_registers;
+        size_t tag_end=(size_t)tag->addr+tag->number;
+
+        if(bits)
+        {
+            if(max_number>MODBUS_MAX_READ_BITS)
+            {
+                max_number=MODBUS_MAX_READ_BITS;
+            }
+        }
+        else if(max_number>MODBUS_MAX_READ_REGISTERS)
+        {
+            max_number=MODBUS_MAX_READ_REGISTERS;
+        }
+
+        if(tag->table>=MODBUS_TABLE_MAX || tag->number==0 || tag->number>max_number || tag_end>0x10000 || (bits && tag->bits==NULL) || (!bits && tag->registers==NULL))
+        {
+            return false;
+        }
+
+        if(Modbus_Read_Plan_Hits_Hole(plan,tag->slave_addr,tag->table,tag->addr,tag_end))
+        {
+            return false;
+        }
+
+        if(request!=NULL && request->slave_addr==tag->slave_addr && request->table==tag->table)
+        {
+            size_t request_end=request->start_addr+request->number;
+            size_t new_end=(tag_end>request_end)?tag_end:request_end;
+            size_t gap=(tag->addr>request_end)?(tag->addr-request_end):0;
+            if(gap<=max_gap && new_end-request->start_addr<=max_number && !Modbus_Read_Plan_Hits_Hole(plan,tag->slave_addr,tag->table,request_end,tag->addr))
+            {
+                //并入当前请求
+                request->number=new_end-request->start_addr;
+                tag->request=plan->request_count-1;
+                continue;
+            }
+        }
+
+        if(plan->request_count>=plan->request_capacity)
+        {
+            return false;
+        }
+
+        request=&plan->requests[plan->request_count++];
+        request->slave_addr=tag->slave_addr;
+        request->table=tag->table;
+        request->start_addr=tag->addr;
+        request->number=tag->number;
+        tag->request=plan->request_count-1;
+    }
+
+    return true;
+}
+
+size_t Modbus_Read_Plan_Execute(modbus_read_plan_t *plan,modbus_master_context_t *ctx,uint8_t *buff,size_t buff_length)
+{
+    if(plan==NULL || ctx==NULL)
+    {
+        return 0;
+    }
+
+    union
+    {
+        bool bits[MODBUS_MAX_READ_BITS];
+        uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    } data;
+
+    uint8_t slave_addr=ctx->slave_addr;
+    size_t success=0;
+    size_t tag_index=0;
+    for(size_t i=0; i<plan->request_count; i++)
+    {
+        const modbus_read_request_t *request=&plan->requests[i];
+        bool ret=false;
+        ctx->slave_addr=request->slave_addr;
+        switch(request->table)
+        {
+        case MODBUS_TABLE_IX:
+            ret=Modbus_Master_Read_IX(ctx,request->start_addr,data.bits,request->number,buff,buff_length);
+            break;
+        case MODBUS_TABLE_OX:
+            ret=Modbus_Master_Read_OX(ctx,request->start_addr,data.bits,request->number,buff,buff_length);
+            break;
+        case MODBUS_TABLE_INPUT_REGISTER:
+            ret=Modbus_Master_Read_Input_Register(ctx,request->start_addr,data.registers,request->number,buff,buff_length);
+            break;
+        case MODBUS_TABLE_HOLD_REGISTER:
+            ret=Modbus_Master_Read_Hold_Register(ctx,request->start_addr,data.registers,request->number,buff,buff_length);
+            break;
+        default:
+            break;
+        }
+
+        if(ret)
+        {
+            success++;
+        }
+
+        //标签已排序,同一请求的标签是连续的
+        for(; tag_index<plan->tag_count && plan->tags[tag_index].request==i; tag_index++)
+        {
+            modbus_read_tag_t *tag=&plan->tags[tag_index];
+            tag->valid=ret;
+            if(!ret)
+            {
+                continue;
+            }
+            size_t offset=tag->addr-request->start_addr;
+            if(Modbus_Read_Plan_Is_Bits(tag->table))
+            {
+                memcpy(tag->bits,&data.bits[offset],tag->number*sizeof(bool));
+            }
+            else
+            {
+                memcpy(tag->registers,&data.registers[offset],tag->number*sizeof(uint16_t));
+            }
+        }
+    }
+    ctx->slave_addr=slave_addr;
+
+    return success;
+}
@@ -0,0 +1,95 @@
+﻿/** \file ModbusReadPlan.h
+ *  \brief     Modbus主机读取计划(合并零散的读取)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_READ_PLAN_H__
+#define __MODBUS_READ_PLAN_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    uint8_t slave_addr;/**< 从机地址 */
+    modbus_table_t table;/**< 表 */
+    uint16_t addr;/**< 起始地址 */
+    uint16_t number;/**< 数量 */
+    bool *bits;/**< 线圈/输入点数据(表为MODBUS_TABLE_IX或MODBUS_TABLE_OX时使用),长度为number */
+    uint16_t *registers;/**< 寄存器数据(表为MODBUS_TABLE_INPUT_REGISTER或MODBUS_TABLE_HOLD_REGISTER时使用),长度为number */
+    bool valid;/**< 最近一次执行计划时是否读取成功 */
+    size_t request;/**< 所属请求的下标(生成计划时填写) */
+} modbus_read_tag_t/**< 读取标签,表示需要读取的一段地址 */;
+
+typedef struct
+{
+    uint8_t slave_addr;/**< 从机地址 */
+    modbus_table_t table;/**< 表 */
+    uint16_t addr;/**< 起始地址 */
+    uint16_t number;/**< 数量 */
+} modbus_read_hole_t/**< 禁止读取的地址范围(读取时从机回应异常),合并请求时不能跨越 */;
+
+typedef struct
+{
+    uint8_t slave_addr;/**< 从机地址 */
+    modbus_table_t table;/**< 表 */
+    uint16_t start_addr;/**< 起始地址 */
+    size_t number;/**< 数量 */
+} modbus_read_request_t/**< 合并后的读取请求 */;
+
+typedef struct
+{
+    modbus_read_tag_t *tags;/**< 标签数组(由用户定义),生成计划时按从机地址、表及起始地址排序 */
+    size_t tag_count;/**< 标签数量 */
+    const modbus_read_hole_t *holes;/**< 禁止读取的地址范围,可为NULL */
+    size_t hole_count;/**< 禁止读取的地址范围数量 */
+    size_t max_gap_bits;/**< 合并线圈/输入点时允许多读取的(不需要的)地址数量 */
+    size_t max_gap_registers;/**< 合并寄存器时允许多读取的(不需要的)地址数量 */
+    size_t max_bits;/**< 单个请求最多读取的线圈/输入点数量(不超过MODBUS_MAX_READ_BITS) */
+    size_t max_registers;/**< 单个请求最多读取的寄存器数量(不超过MODBUS_MAX_READ_REGISTERS) */
+    modbus_read_request_t *requests;/**< 请求数组(由用户定义),用于存放生成的请求 */
+    size_t request_capacity;/**< 请求数组长度 */
+    size_t request_count;/**< 生成的请求数量 */
+} modbus_read_plan_t/**< 读取计划,不使用动态内存 */;
+
+/** \brief 初始化读取计划(允许的间隔为0,单个请求的最大数量为协议允许的最大值)
+ *
+ * \param plan 读取计划
+ * \param tags 标签数组
+ * \param tag_count 标签数量
+ * \param requests 请求数组(最坏情况下与标签数量相同)
+ * \param request_capacity 请求数组长度
+ *
+ */
+void Modbus_Read_Plan_Init(modbus_read_plan_t *plan,modbus_read_tag_t *tags,size_t tag_count,modbus_read_request_t *requests,size_t request_capacity);
+
+/** \brief 生成计划:将同一从机同一表中相邻或间隔不超过允许值的标签合并为尽量少的请求
+ *
+ * \param plan 读取计划
+ * \return 是否成功(标签数量超出单个请求的最大数量、标签超出地址范围(起始地址+数量>0x10000)、标签位于禁止读取的地址范围中或请求数组不足时失败)
+ *
+ */
+bool Modbus_Read_Plan_Build(modbus_read_plan_t *plan);
+
+/** \brief 执行计划:依次发送请求(阻塞),并将数据分发到各标签
+ *
+ * \param plan 读取计划(已生成)
+ * \param ctx 主机上下文,slave_addr在执行时按请求修改,执行后恢复
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 成功的请求数量,失败的请求中的标签valid为false
+ *
+ */
+size_t Modbus_Read_Plan_Execute(modbus_read_plan_t *plan,modbus_master_context_t *ctx,uint8_t *buff,size_t buff_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+﻿/** \file ModbusRegisterBank.c
+ *  \brief     Modbus从机寄存器存储(连续数组)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusRegisterBank.h"
+#include "ModbusPack.h"
+
+static bool Modbus_Register_Bank_Is_Bits(modbus_table_t table)
+{
+    return table==MODBUS_TABLE_IX || table==MODBUS_TABLE_OX;
+}
+
+void Modbus_Register_Bank_Init(modbus_register_bank_t *bank)
+{
+    if(bank==NULL)
+    {
+        return;
+    }
+
+    memset(bank,0,sizeof(modbus_register_bank_t));
+}
+
+bool Modbus_Register_Bank_Set_Table(modbus_register_bank_t *bank,modbus_table_t table,uint16_t base,size_t size,void *data)
+{
+    if(bank==NULL || table>=MODBUS_TABLE_MAX || (size!=0 && data==NULL) || (size_t)base+size>0x10000)
+    {
+        return false;
+    }
+
+    bank->tables[table].base=base;
+    bank->tables[table].size=size;
+    bank->tables[table].data=data;
+
+    return true;
+}
+
+bool Modbus_Register_Bank_Table_Contains(const modbus_register_bank_table_t *t,size_t addr,size_t number)
+{
+    if(t==NULL)
+    {
+        return false;
+    }
+
+    return t->size!=0 && t->data!=NULL && addr>=t->base && number<=t->size && (addr-t->base)<=(t->size-number);
+}
+
+bool Modbus_Register_Bank_Contains(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr,size_t number)
+{
+    if(bank==NULL || table>=MODBUS_TABLE_MAX)
+    {
+        return false;
+    }
+
+    return Modbus_Register_Bank_Table_Contains(&bank->tables[table],addr,number);
+}
+
+bool Modbus_Register_Bank_Table_Read_Bits(const modbus_register_bank_table_t *t,size_t addr,uint8_t *data,size_t number)
+{
+    if(data==NULL || number==0 || !Modbus_Register_Bank_Table_Contains(t,addr,number))
+    {
+        return false;
+    }
+
+    const uint8_t *src=(const uint8_t *)t->data;
+    size_t offset=addr-t->base;
+    size_t byte_count=(number+7)/8;
+    size_t shift=offset%8;
+    src+=offset/8;
+
+    if(shift==0)
+    {
+        //按字节对齐,直接复制
+        memcpy(data,src,byte_count);
+    }
+    else
+    {
+        //不对齐,逐字节移位拼接
+        size_t src_bytes=(shift+number+7)/8;
+        for(size_t i=0; i<byte_count; i++)
+        {
+            uint8_t value=(src[i]>>shift);
+            if(i+1<src_bytes)
+            {
+                value|=(uint8_t)(src[i+1]<<(8-shift));
+            }
+            data[i]=value;
+        }
+    }
+
+    if(number%8!=0)
+    {
+        //多余的位填0
+        data[byte_count-1]&=(0xFF>>(8-number%8));
+    }
+
+    return true;
+}
+
+const uint8_t *Modbus_Register_Bank_Table_Bits_Pointer(const modbus_register_bank_table_t *t,size_t addr,size_t number)
+{
+    if(number==0 || number%8!=0 || !Modbus_Register_Bank_Table_Contains(t,addr,number) || (addr-t->base)%8!=0)
+    {
+        return NULL;
+    }
+
+    return ((const uint8_t *)t->data)+(addr-t->base)/8;
+}
+
+bool Modbus_Register_Bank_Table_Write_Bits(const modbus_register_bank_table_t *t,size_t addr,const uint8_t *data,size_t number)
+{
+    if(data==NULL || number==0 || !Modbus_Register_Bank_Table_Contains(t,addr,number))
+    {
+        return false;
+    }
+
+    uint8_t *dst=(uint8_t *)t->data;
+    size_t offset=addr-t->base;
+
+    size_t i=0;
+    if(offset%8==0)
+    {
+        //按字节对齐,整字节直接复制
+        memcpy(&dst[offset/8],data,number/8);
+        i=number-number%8;
+    }
+
+    for(; i<number; i++)
+    {
+        size_t pos=offset+i;
+        if((data[i/8]&(0x01<<(i%8)))!=0)
+        {
+            dst[pos/8]|=(0x01<<(pos%8));
+        }
+        else
+        {
+            dst[pos/8]&=(~(0x01<<(pos%8)));
+        }
+    }
+
+    return true;
+}
+
+bool Modbus_Register_Bank_Table_Read_Registers(const modbus_register_bank_table_t *t,size_t addr,uint8_t *data,size_t number)
+{
+    if(data==NULL || number==0 || !Modbus_Register_Bank_Table_Contains(t,addr,number))
+    {
+        return false;
+    }
+
+    //modbus的16位数据高字节在前,低字节在后
+    Modbus_Pack_Registers(data,((const uint16_t *)t->data)+(addr-t->base),number);
+
+    return true;
+}
+
+bool Modbus_Register_Bank_Table_Write_Registers(const modbus_register_bank_table_t *t,size_t addr,const uint8_t *data,size_t number)
+{
+    if(data==NULL || number==0 || !Modbus_Register_Bank_Table_Contains(t,addr,number))
+    {
+        return false;
+    }
+
+    //modbus的16位数据高字节在前,低字节在后
+    Modbus_Unpack_Registers(((uint16_t *)t->data)+(addr-t->base),data,number);
+
+    return true;
+}
+
+bool Modbus_Register_Bank_Read_Bits(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr,uint8_t *data,size_t number)
+{
+    if(bank==NULL || !Modbus_Register_Bank_Is_Bits(table))
+    {
+        return false;
+    }
+
+    return Modbus_Register_Bank_Table_Read_Bits(&bank->tables[table],addr,data,number);
+}
+
+bool Modbus_Register_Bank_Write_Bits(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,const uint8_t *data,size_t number)
+{
+    if(bank==NULL || !Modbus_Register_Bank_Is_Bits(table))
+    {
+        return false;
+    }
+
+    if(!Modbus_Register_Bank_Table_Write_Bits(&bank->tables[table],addr,data,number))
+    {
+        return false;
+    }
+
+    if(bank->on_write!=NULL)
+    {
+        bank->on_write(bank,table,addr,number);
+    }
+
+    return true;
+}
+
+bool Modbus_Register_Bank_Read_Registers(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr,uint8_t *data,size_t number)
+{
+    if(bank==NULL || table>=MODBUS_TABLE_MAX || Modbus_Register_Bank_Is_Bits(table))
+    {
+        return false;
+    }
+
+    return Modbus_Register_Bank_Table_Read_Registers(&bank->tables[table],addr,data,number);
+}
+
+bool Modbus_Register_Bank_Write_Registers(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,const uint8_t *data,size_t number)
+{
+    if(bank==NULL || table>=MODBUS_TABLE_MAX || Modbus_Register_Bank_Is_Bits(table))
+    {
+        return false;
+    }
+
+    if(!Modbus_Register_Bank_Table_Write_Registers(&bank->tables[table],addr,data,number))
+    {
+        return false;
+    }
+
+    if(bank->on_write!=NULL)
+    {
+        bank->on_write(bank,table,addr,number);
+    }
+
+    return true;
+}
+
+bool Modbus_Register_Bank_Get_Bit(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr)
+{
+    if(!Modbus_Register_Bank_Is_Bits(table) || !Modbus_Register_Bank_Contains(bank,table,addr,1))
+    {
+        return false;
+    }
+
+    const uint8_t *src=(const uint8_t *)bank->tables[table].data;
+    size_t offset=addr-bank->tables[table].base;
+    return (src[offset/8]&(0x01<<(offset%8)))!=0;
+}
+
+bool Modbus_Register_Bank_Set_Bit(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,bool value)
+{
+    if(!Modbus_Register_Bank_Is_Bits(table) || !Modbus_Register_Bank_Contains(bank,table,addr,1))
+    {
+        return false;
+    }
+
+    uint8_t *dst=(uint8_t *)bank->tables[table].data;
+    size_t offset=addr-bank->tables[table].base;
+    if(value)
+    {
+        dst[offset/8]|=(0x01<<(offset%8));
+    }
+    else
+    {
+        dst[offset/8]&=(~(0x01<<(offset%8)));
+    }
+    return true;
+}
+
+uint16_t Modbus_Register_Bank_Get_Register(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr)
+{
+    if(Modbus_Register_Bank_Is_Bits(table) || !Modbus_Register_Bank_Contains(bank,table,addr,1))
+    {
+        return 0;
+    }
+
+    return ((const uint16_t *)bank->tables[table].data)[addr-bank->tables[table].base];
+}
+
+bool Modbus_Register_Bank_Set_Register(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,uint16_t value)
+{
+    if(Modbus_Register_Bank_Is_Bits(table) || !Modbus_Register_Bank_Contains(bank,table,addr,1))
+    {
+        return false;
+    }
+
+    ((uint16_t *)bank->tables[table].data)[addr-bank->tables[table].base]=value;
+    return true;
+}
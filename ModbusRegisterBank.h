@@ -0,0 +1,265 @@
+﻿/** \file ModbusRegisterBank.h
+ *  \brief     Modbus从机寄存器存储(连续数组)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_REGISTER_BANK_H__
+#define __MODBUS_REGISTER_BANK_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+存储数组的对齐(缓存行),可在编译时重新定义。
+*/
+#ifndef MODBUS_REGISTER_BANK_ALIGN
+#if defined(__GNUC__) || defined(__clang__)
+#define MODBUS_REGISTER_BANK_ALIGN __attribute__((aligned(64)))
+#elif defined(_MSC_VER)
+#define MODBUS_REGISTER_BANK_ALIGN __declspec(align(64))
+#else
+#define MODBUS_REGISTER_BANK_ALIGN
+#endif
+#endif
+
+/*
+定义线圈/输入点存储数组(按位打包)
+*/
+#define MODBUS_REGISTER_BANK_DEFINE_BITS(name,count) MODBUS_REGISTER_BANK_ALIGN uint8_t name[((count)+7)/8]
+
+/*
+定义寄存器存储数组
+*/
+#define MODBUS_REGISTER_BANK_DEFINE_REGISTERS(name,count) MODBUS_REGISTER_BANK_ALIGN uint16_t name[(count)]
+
+typedef struct
+{
+    uint16_t base;/**< 起始地址 */
+    size_t size;/**< 数量,为0时表示不使用此表 */
+    void *data;/**< 存储数组,线圈/输入点为按位打包的uint8_t数组(低位在前),寄存器为uint16_t数组 */
+} modbus_register_bank_table_t/**< 寄存器存储中的一个表 */;
+
+struct modbus_register_bank
+{
+    modbus_register_bank_table_t tables[MODBUS_TABLE_MAX];/**< 按modbus_table_t索引的表 */
+
+    /** \brief 拦截,可为NULL。返回true时此请求不使用寄存器存储,而是调用从机上下文中的回调函数。
+     *
+     * \param bank 寄存器存储
+     * \param table 表
+     * \param addr 起始地址
+     * \param number 数量
+     * \param write 是否为写请求
+     * \return 是否拦截
+     *
+     */
+    bool (*intercept)(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,size_t number,bool write);
+
+    /** \brief 写入通知,可为NULL。主机写入寄存器存储后调用。
+     *
+     * \param bank 寄存器存储
+     * \param table 表
+     * \param addr 起始地址
+     * \param number 数量
+     *
+     */
+    void (*on_write)(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,size_t number);
+
+    void *usr;/**< 用户数据 */
+}/**< 寄存器存储,数组由用户定义(推荐使用MODBUS_REGISTER_BANK_DEFINE_BITS/MODBUS_REGISTER_BANK_DEFINE_REGISTERS) */;
+
+/** \brief 初始化寄存器存储(不使用任何表)
+ *
+ * \param bank 寄存器存储
+ *
+ */
+void Modbus_Register_Bank_Init(modbus_register_bank_t *bank);
+
+/** \brief 设置寄存器存储中的表
+ *
+ * \param bank 寄存器存储
+ * \param table 表
+ * \param base 起始地址
+ * \param size 数量(base+size不能超过65536)
+ * \param data 存储数组,线圈/输入点为按位打包的uint8_t数组,寄存器为uint16_t数组
+ * \return 是否调用成功
+ *
+ */
+bool Modbus_Register_Bank_Set_Table(modbus_register_bank_t *bank,modbus_table_t table,uint16_t base,size_t size,void *data);
+
+/** \brief 检查地址范围是否全部位于单个表中
+ *
+ * \param t 表
+ * \param addr 起始地址
+ * \param number 数量
+ * \return 是否位于表中
+ *
+ */
+bool Modbus_Register_Bank_Table_Contains(const modbus_register_bank_table_t *t,size_t addr,size_t number);
+
+/** \brief 从单个表(按位打包的数组)读取线圈/输入点
+ *
+ * \param t 表
+ * \param addr 起始地址
+ * \param data 数据(按位打包,低位在前,多余的位填0)
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Table_Read_Bits(const modbus_register_bank_table_t *t,size_t addr,uint8_t *data,size_t number);
+
+/** \brief 获取单个表中线圈/输入点的存储指针(用于直接输出,不复制)
+ *
+ * \param t 表
+ * \param addr 起始地址
+ * \param number 数量
+ * \return 存储指针,地址范围不在表中或起始地址/数量不是8的倍数(不能按字节直接输出)时返回NULL
+ *
+ */
+const uint8_t *Modbus_Register_Bank_Table_Bits_Pointer(const modbus_register_bank_table_t *t,size_t addr,size_t number);
+
+/** \brief 向单个表(按位打包的数组)写入线圈/输入点
+ *
+ * \param t 表
+ * \param addr 起始地址
+ * \param data 数据(按位打包,低位在前)
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Table_Write_Bits(const modbus_register_bank_table_t *t,size_t addr,const uint8_t *data,size_t number);
+
+/** \brief 从单个表(uint16_t数组)读取寄存器并转换为Modbus数据帧格式(高字节在前)
+ *
+ * \param t 表
+ * \param addr 起始地址
+ * \param data 数据(高字节在前),长度为number*2
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Table_Read_Registers(const modbus_register_bank_table_t *t,size_t addr,uint8_t *data,size_t number);
+
+/** \brief 向单个表(uint16_t数组)写入Modbus数据帧格式(高字节在前)的寄存器
+ *
+ * \param t 表
+ * \param addr 起始地址
+ * \param data 数据(高字节在前),长度为number*2
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Table_Write_Registers(const modbus_register_bank_table_t *t,size_t addr,const uint8_t *data,size_t number);
+
+/** \brief 检查地址范围是否全部位于表中
+ *
+ * \param bank 寄存器存储
+ * \param table 表
+ * \param addr 起始地址
+ * \param number 数量
+ * \return 是否位于表中
+ *
+ */
+bool Modbus_Register_Bank_Contains(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr,size_t number);
+
+/** \brief 读取线圈/输入点
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_IX或MODBUS_TABLE_OX)
+ * \param addr 起始地址
+ * \param data 数据(按位打包,低位在前,多余的位填0)
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Read_Bits(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr,uint8_t *data,size_t number);
+
+/** \brief 写入线圈/输入点
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_IX或MODBUS_TABLE_OX)
+ * \param addr 起始地址
+ * \param data 数据(按位打包,低位在前)
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Write_Bits(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,const uint8_t *data,size_t number);
+
+/** \brief 读取寄存器并转换为Modbus数据帧格式(高字节在前)
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_INPUT_REGISTER或MODBUS_TABLE_HOLD_REGISTER)
+ * \param addr 起始地址
+ * \param data 数据(高字节在前),长度为number*2
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Read_Registers(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr,uint8_t *data,size_t number);
+
+/** \brief 写入Modbus数据帧格式(高字节在前)的寄存器
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_INPUT_REGISTER或MODBUS_TABLE_HOLD_REGISTER)
+ * \param addr 起始地址
+ * \param data 数据(高字节在前),长度为number*2
+ * \param number 数量
+ * \return 是否成功(地址范围不在表中时失败)
+ *
+ */
+bool Modbus_Register_Bank_Write_Registers(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,const uint8_t *data,size_t number);
+
+/** \brief 读取单个线圈/输入点(供应用程序使用)
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_IX或MODBUS_TABLE_OX)
+ * \param addr 地址
+ * \return 当前状态,地址不在表中时返回false
+ *
+ */
+bool Modbus_Register_Bank_Get_Bit(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr);
+
+/** \brief 设置单个线圈/输入点(供应用程序使用,不调用on_write)
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_IX或MODBUS_TABLE_OX)
+ * \param addr 地址
+ * \param value 状态
+ * \return 是否成功
+ *
+ */
+bool Modbus_Register_Bank_Set_Bit(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,bool value);
+
+/** \brief 读取单个寄存器(供应用程序使用)
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_INPUT_REGISTER或MODBUS_TABLE_HOLD_REGISTER)
+ * \param addr 地址
+ * \return 数据,地址不在表中时返回0
+ *
+ */
+uint16_t Modbus_Register_Bank_Get_Register(const modbus_register_bank_t *bank,modbus_table_t table,size_t addr);
+
+/** \brief 设置单个寄存器(供应用程序使用,不调用on_write)
+ *
+ * \param bank 寄存器存储
+ * \param table 表(MODBUS_TABLE_INPUT_REGISTER或MODBUS_TABLE_HOLD_REGISTER)
+ * \param addr 地址
+ * \param value 数据
+ * \return 是否成功
+ *
+ */
+bool Modbus_Register_Bank_Set_Register(modbus_register_bank_t *bank,modbus_table_t table,size_t addr,uint16_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
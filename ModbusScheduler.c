@@ -0,0 +1,216 @@
+﻿/** \file ModbusScheduler.c
+ *  \brief     Modbus主机多周期轮询调度(最早截止时间优先)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusScheduler.h"
+
+void Modbus_Scheduler_Init(modbus_scheduler_t *scheduler,modbus_master_context_t *ctx,modbus_poll_group_t *groups,size_t group_count,uint8_t *buff,size_t buff_length,uint32_t baudrate)
+{
+    if(scheduler==NULL)
+    {
+        return;
+    }
+
+    memset(scheduler,0,sizeof(modbus_scheduler_t));
+    scheduler->ctx=ctx;
+    scheduler->groups=groups;
+    scheduler->group_count=group_count;
+    scheduler->buff=buff;
+    scheduler->buff_length=buff_length;
+    Modbus_Timing_Init(&scheduler->timing,baudrate,MODBUS_PARITY_EVEN,1);
+}
+
+uint32_t Modbus_Scheduler_Plan_Airtime(const modbus_scheduler_t *scheduler,const modbus_read_plan_t *plan)
+{
+    if(scheduler==NULL || plan==NULL || scheduler->timing.baudrate==0)
+    {
+        return 0;
+    }
+
+    uint64_t airtime=0;
+    for(size_t i=0; i<plan->request_count; i++)
+    {
+        const modbus_read_request_t *request=&plan->requests[i];
+        size_t byte_count=(request->table==MODBUS_TABLE_IX || request->table==MODBUS_TABLE_OX)?(request->number/8+((request->number%8!=0)?1:0)):(request->number*2);
+        airtime+=Modbus_Timing_Transaction_Time(&scheduler->timing,8,5+byte_count);
+    }
+
+    return (airtime>0xFFFFFFFF)?0xFFFFFFFF:(uint32_t)airtime;
+}
+
+void Modbus_Scheduler_Start(modbus_scheduler_t *scheduler,uint32_t now)
+{
+    if(scheduler==NULL || scheduler->groups==NULL)
+    {
+        return;
+    }
+
+    for(size_t i=0; i<scheduler->group_count; i++)
+    {
+        modbus_poll_group_t *group=&scheduler->groups[i];
+        group->airtime=Modbus_Scheduler_Plan_Airtime(scheduler,group->plan);
+        group->release=now+group->offset;
+        group->current_release=group->release;
+        group->deadline=group->release+group->period;
+        group->pending=false;
+        group->runs=0;
+        group->overruns=0;
+        group->deadline_misses=0;
+        group->last_jitter=0;
+        group->max_jitter=0;
+        group->total_jitter=0;
+        group->last_response=0;
+        group->max_response=0;
+    }
+}
+
+uint32_t Modbus_Scheduler_Utilization(const modbus_scheduler_t *scheduler)
+{
+    if(scheduler==NULL || scheduler->groups==NULL)
+    {
+        return 0;
+    }
+
+    uint64_t utilization=0;
+    for(size_t i=0; i<scheduler->group_count; i++)
+    {
+        const modbus_poll_group_t *group=&scheduler->groups[i];
+        if(group->period!=0)
+        {
+            utilization+=((uint64_t)group->airtime*1000+group->period-1)/group->period;
+        }
+    }
+
+    return (utilization>0xFFFFFFFF)?0xFFFFFFFF:(uint32_t)utilization;
+}
+
+/*
+释放到期的轮询组。上一实例尚未执行时记为一次超限,按新的释放时刻重新计算截止时间。
+*/
+static void Modbus_Scheduler_Release(modbus_scheduler_t *scheduler,uint32_t now)
+{
+    for(size_t i=0; i<scheduler->group_count; i++)
+    {
+        modbus_poll_group_t *group=&scheduler->groups[i];
+        if(group->period==0 || group->plan==NULL)
+        {
+            continue;
+        }
+
+        while((int32_t)(now-group->release)>=0)
+        {
+            if(group->pending)
+            {
+                group->overruns++;
+            }
+            group->pending=true;
+            group->current_release=group->release;
+            group->deadline=group->release+group->period;
+            group->release+=group->period;
+        }
+    }
+}
+
+modbus_poll_group_t *Modbus_Scheduler_Run_Once(modbus_scheduler_t *scheduler,uint32_t now)
+{
+    if(scheduler==NULL || scheduler->groups==NULL || scheduler->ctx==NULL)
+    {
+        return NULL;
+    }
+
+    Modbus_Scheduler_Release(scheduler,now);
+
+    //最早截止时间优先,截止时间相同时周期短的优先
+    modbus_poll_group_t *next=NULL;
+    for(size_t i=0; i<scheduler->group_count; i++)
+    {
+        modbus_poll_group_t *group=&scheduler->groups[i];
+        if(!group->pending)
+        {
+            continue;
+        }
+        if(next==NULL)
+        {
+            next=group;
+            continue;
+        }
+        int32_t diff=(int32_t)(group->deadline-next->deadline);
+        if(diff<0 || (diff==0 && group->period<next->period))
+        {
+            next=group;
+        }
+    }
+
+    if(next==NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t jitter=now-next->current_release;
+    next->pending=false;
+    next->runs++;
+    next->last_jitter=jitter;
+    next->total_jitter+=jitter;
+    if(jitter>next->max_jitter)
+    {
+        next->max_jitter=jitter;
+    }
+
+    size_t success=Modbus_Read_Plan_Execute(next->plan,scheduler->ctx,scheduler->buff,scheduler->buff_length);
+
+    uint32_t end=(scheduler->get_time!=NULL)?scheduler->get_time(scheduler):(now+next->airtime);
+    uint32_t response=end-next->current_release;
+    next->last_response=response;
+    if(response>next->max_response)
+    {
+        next->max_response=response;
+    }
+    if((int32_t)(end-next->deadline)>0)
+    {
+        next->deadline_misses++;
+    }
+
+    if(next->complete!=NULL)
+    {
+        next->complete(next,success);
+    }
+
+    return next;
+}
+
+uint32_t Modbus_Scheduler_Idle_Time(const modbus_scheduler_t *scheduler,uint32_t now)
+{
+    if(scheduler==NULL || scheduler->groups==NULL)
+    {
+        return 0;
+    }
+
+    uint32_t idle=0xFFFFFFFF;
+    for(size_t i=0; i<scheduler->group_count; i++)
+    {
+        const modbus_poll_group_t *group=&scheduler->groups[i];
+        if(group->period==0 || group->plan==NULL)
+        {
+            continue;
+        }
+        if(group->pending)
+        {
+            return 0;
+        }
+        int32_t remain=(int32_t)(group->release-now);
+        if(remain<=0)
+        {
+            return 0;
+        }
+        if((uint32_t)remain<idle)
+        {
+            idle=remain;
+        }
+    }
+
+    return idle;
+}
@@ -0,0 +1,137 @@
+﻿/** \file ModbusScheduler.h
+ *  \brief     Modbus主机多周期轮询调度(最早截止时间优先)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_SCHEDULER_H__
+#define __MODBUS_SCHEDULER_H__
+
+#include "Modbus.h"
+#include "ModbusReadPlan.h"
+#include "ModbusTiming.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct modbus_poll_group modbus_poll_group_t;
+
+struct modbus_poll_group
+{
+    modbus_read_plan_t *plan;/**< 读取计划(已生成),每个周期执行一次 */
+    uint32_t period;/**< 周期(us),截止时间为释放后一个周期 */
+    uint32_t offset;/**< 第一次释放相对于调度器启动的时间(us),用于错开周期相同的轮询组 */
+
+    /** \brief 每次执行完成后调用,可为NULL。
+     *
+     * \param group 轮询组
+     * \param success 成功的请求数量
+     *
+     */
+    void (*complete)(modbus_poll_group_t *group,size_t success);
+
+    void *usr;/**< 用户数据 */
+
+    uint32_t airtime;/**< 估算的一次执行占用总线的时间(us),启动调度器时计算 */
+    uint32_t release;/**< 下一次释放时刻 */
+    uint32_t current_release;/**< 当前实例的释放时刻 */
+    uint32_t deadline;/**< 当前实例的截止时刻 */
+    bool pending;/**< 当前实例是否已释放但尚未执行 */
+
+    uint32_t runs;/**< 统计:执行次数 */
+    uint32_t overruns;/**< 统计:上一实例尚未执行就再次释放(被跳过)的次数 */
+    uint32_t deadline_misses;/**< 统计:执行完成时已超过截止时间的次数 */
+    uint32_t last_jitter;/**< 统计:最近一次开始执行时刻与释放时刻之差(us) */
+    uint32_t max_jitter;/**< 统计:最大抖动(us) */
+    uint64_t total_jitter;/**< 统计:抖动之和(us),除以runs得到平均抖动 */
+    uint32_t last_response;/**< 统计:最近一次完成时刻与释放时刻之差(us) */
+    uint32_t max_response;/**< 统计:最大响应时间(us) */
+}/**< 轮询组,一组按相同周期轮询的标签 */;
+
+typedef struct modbus_scheduler modbus_scheduler_t;
+
+struct modbus_scheduler
+{
+    modbus_poll_group_t *groups;/**< 轮询组数组(由用户定义) */
+    size_t group_count;/**< 轮询组数量 */
+    modbus_master_context_t *ctx;/**< 主机上下文(一条总线) */
+    uint8_t *buff;/**< 缓冲,用于发送和接收数据 */
+    size_t buff_length;/**< 缓冲长度 */
+
+    modbus_timing_t timing;/**< 总线时序,用于估算传输时间(可修改turnaround设置估算的从机处理时间) */
+
+    /** \brief 获取当前时间(us),可为NULL(此时按估算的传输时间计算完成时刻)。
+     *
+     * \param scheduler 调度器
+     * \return 当前时间(us)
+     *
+     */
+    uint32_t (*get_time)(modbus_scheduler_t *scheduler);
+
+    void *usr;/**< 用户数据 */
+};
+
+/** \brief 初始化调度器(偶校验1停止位即11位字符,从机处理时间为0,其它串口参数可再调用Modbus_Timing_Init设置timing)
+ *
+ * \param scheduler 调度器
+ * \param ctx 主机上下文
+ * \param groups 轮询组数组
+ * \param group_count 轮询组数量
+ * \param buff 缓冲
+ * \param buff_length 缓冲长度
+ * \param baudrate 波特率
+ *
+ */
+void Modbus_Scheduler_Init(modbus_scheduler_t *scheduler,modbus_master_context_t *ctx,modbus_poll_group_t *groups,size_t group_count,uint8_t *buff,size_t buff_length,uint32_t baudrate);
+
+/** \brief 估算一个读取计划占用总线的时间(请求、回应、帧间隔t3.5及从机处理时间)
+ *
+ * \param scheduler 调度器
+ * \param plan 读取计划(已生成)
+ * \return 时间(us)
+ *
+ */
+uint32_t Modbus_Scheduler_Plan_Airtime(const modbus_scheduler_t *scheduler,const modbus_read_plan_t *plan);
+
+/** \brief 启动调度器:计算各轮询组的传输时间,清空统计,并设置第一次释放时刻
+ *
+ * \param scheduler 调度器
+ * \param now 当前时间(us)
+ *
+ */
+void Modbus_Scheduler_Start(modbus_scheduler_t *scheduler,uint32_t now);
+
+/** \brief 总线利用率(各轮询组传输时间与周期之比的和),超过1000时不可能满足所有截止时间
+ *
+ * \param scheduler 调度器(已启动)
+ * \return 利用率(千分比)
+ *
+ */
+uint32_t Modbus_Scheduler_Utilization(const modbus_scheduler_t *scheduler);
+
+/** \brief 释放到期的轮询组,并执行截止时间最早的一个(阻塞)
+ *
+ * \param scheduler 调度器
+ * \param now 当前时间(us)
+ * \return 执行的轮询组,没有需要执行的轮询组时返回NULL
+ *
+ */
+modbus_poll_group_t *Modbus_Scheduler_Run_Once(modbus_scheduler_t *scheduler,uint32_t now);
+
+/** \brief 距离下一次需要调用Modbus_Scheduler_Run_Once的时间
+ *
+ * \param scheduler 调度器
+ * \param now 当前时间(us)
+ * \return 时间(us),有已释放未执行的轮询组时为0
+ *
+ */
+uint32_t Modbus_Scheduler_Idle_Time(const modbus_scheduler_t *scheduler,uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
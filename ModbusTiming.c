@@ -0,0 +1,96 @@
+﻿/** \file ModbusTiming.c
+ *  \brief     Modbus RTU总线时序(t1.5/t3.5、帧传输时间及发送/回应时刻)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusTiming.h"
+
+bool Modbus_Timing_Init(modbus_timing_t *timing,uint32_t baudrate,modbus_parity_t parity,uint8_t stop_bits)
+{
+    if(timing==NULL || baudrate==0 || (stop_bits!=1 && stop_bits!=2))
+    {
+        return false;
+    }
+
+    memset(timing,0,sizeof(modbus_timing_t));
+    timing->baudrate=baudrate;
+    timing->bits_per_char=1+8+((parity!=MODBUS_PARITY_NONE)?1:0)+stop_bits;
+    timing->char_time=(uint32_t)(((uint64_t)timing->bits_per_char*1000000+baudrate-1)/baudrate);
+
+    if(baudrate>19200)
+    {
+        //波特率高于19200时使用固定值
+        timing->t15=750;
+        timing->t35=1750;
+    }
+    else
+    {
+        timing->t15=(timing->char_time*3+1)/2;
+        timing->t35=(timing->char_time*7+1)/2;
+    }
+
+    return true;
+}
+
+uint32_t Modbus_Timing_Frame_Time(const modbus_timing_t *timing,size_t length)
+{
+    if(timing==NULL)
+    {
+        return 0;
+    }
+
+    uint64_t time=(uint64_t)length*timing->char_time;
+    return (time>0xFFFFFFFF)?0xFFFFFFFF:(uint32_t)time;
+}
+
+uint32_t Modbus_Timing_Transaction_Time(const modbus_timing_t *timing,size_t request_length,size_t reply_length)
+{
+    if(timing==NULL)
+    {
+        return 0;
+    }
+
+    uint64_t time=(uint64_t)Modbus_Timing_Frame_Time(timing,request_length)+timing->t35+timing->turnaround;
+    if(reply_length!=0)
+    {
+        time+=(uint64_t)Modbus_Timing_Frame_Time(timing,reply_length)+timing->t35;
+    }
+
+    return (time>0xFFFFFFFF)?0xFFFFFFFF:(uint32_t)time;
+}
+
+void Modbus_Timing_Frame_End(modbus_timing_t *timing,uint32_t timestamp)
+{
+    if(timing==NULL)
+    {
+        return;
+    }
+
+    timing->last_end=timestamp;
+    timing->has_last_end=true;
+}
+
+uint32_t Modbus_Timing_Earliest_Transmit(const modbus_timing_t *timing,uint32_t now)
+{
+    if(timing==NULL || !timing->has_last_end)
+    {
+        return now;
+    }
+
+    uint32_t earliest=timing->last_end+timing->t35;
+    return ((int32_t)(earliest-now)>0)?earliest:now;
+}
+
+uint32_t Modbus_Timing_Reply_Deadline(const modbus_timing_t *timing,uint32_t tx_start,size_t request_length,size_t reply_length)
+{
+    if(timing==NULL)
+    {
+        return tx_start;
+    }
+
+    //请求发送完成后从机需等待t3.5才能确认请求结束,回应结束后再留t3.5余量
+    return tx_start+Modbus_Timing_Transaction_Time(timing,request_length,reply_length);
+}
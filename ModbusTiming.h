@@ -0,0 +1,99 @@
+﻿/** \file ModbusTiming.h
+ *  \brief     Modbus RTU总线时序(t1.5/t3.5、帧传输时间及发送/回应时刻)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_TIMING_H__
+#define __MODBUS_TIMING_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    MODBUS_PARITY_NONE=0,/**< 无校验 */
+    MODBUS_PARITY_ODD,/**< 奇校验 */
+    MODBUS_PARITY_EVEN,/**< 偶校验 */
+} modbus_parity_t/**< 串口校验方式 */;
+
+typedef struct
+{
+    uint32_t baudrate;/**< 波特率 */
+    uint32_t bits_per_char;/**< 每个字符的位数(起始位+8数据位+校验位+停止位) */
+    uint32_t char_time;/**< 单个字符的传输时间(us) */
+    uint32_t t15;/**< 字符间最大间隔t1.5(us),波特率高于19200时固定为750us */
+    uint32_t t35;/**< 帧间隔t3.5(us),波特率高于19200时固定为1750us */
+    uint32_t turnaround;/**< 从机处理时间(us),广播请求后主机等待此时间,默认为0 */
+    uint32_t last_end;/**< 总线上最近一帧(发送或接收)结束的时刻(us) */
+    bool has_last_end;/**< last_end是否有效 */
+} modbus_timing_t/**< 总线时序,所有时间单位为us(时间戳允许回绕) */;
+
+/** \brief 按串口参数初始化时序,计算出的char_time、t15、t35也可用于Modbus_RTU_Deframer_Init
+ *
+ * \param timing 时序
+ * \param baudrate 波特率
+ * \param parity 校验方式
+ * \param stop_bits 停止位(1或2)
+ * \return 是否成功
+ *
+ */
+bool Modbus_Timing_Init(modbus_timing_t *timing,uint32_t baudrate,modbus_parity_t parity,uint8_t stop_bits);
+
+/** \brief 一帧数据的传输时间
+ *
+ * \param timing 时序
+ * \param length 帧长度(包含CRC)
+ * \return 传输时间(us)
+ *
+ */
+uint32_t Modbus_Timing_Frame_Time(const modbus_timing_t *timing,size_t length);
+
+/** \brief 一次请求占用总线的时间(请求、t3.5、从机处理时间,有回应时再加上回应及t3.5)
+ *
+ * \param timing 时序
+ * \param request_length 请求长度
+ * \param reply_length 回应长度,广播请求为0
+ * \return 时间(us)
+ *
+ */
+uint32_t Modbus_Timing_Transaction_Time(const modbus_timing_t *timing,size_t request_length,size_t reply_length);
+
+/** \brief 记录总线上一帧结束(发送完成或收到最后一个字节)
+ *
+ * \param timing 时序
+ * \param timestamp 帧结束的时刻(us)
+ *
+ */
+void Modbus_Timing_Frame_End(modbus_timing_t *timing,uint32_t timestamp);
+
+/** \brief 最早可以开始发送下一帧的时刻(上一帧结束后t3.5)
+ *
+ * \param timing 时序
+ * \param now 当前时刻(us)
+ * \return 最早发送时刻(us),不早于now
+ *
+ */
+uint32_t Modbus_Timing_Earliest_Transmit(const modbus_timing_t *timing,uint32_t now);
+
+/** \brief 预计回应接收完成的时刻(请求发送、t3.5、从机处理及回应传输,加上t3.5余量,即Modbus_Timing_Transaction_Time),可用于主机的超时时刻
+ *
+ * \param timing 时序
+ * \param tx_start 开始发送请求的时刻(us)
+ * \param request_length 请求长度
+ * \param reply_length 回应长度
+ * \return 回应完成时刻(us)
+ *
+ */
+uint32_t Modbus_Timing_Reply_Deadline(const modbus_timing_t *timing,uint32_t tx_start,size_t request_length,size_t reply_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,280 @@
+﻿/** \file ModbusValue.c
+ *  \brief     Modbus多寄存器数值(32/64位整数及浮点数)解码/编码C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusValue.h"
+
+size_t Modbus_Value_Registers(modbus_value_type_t type)
+{
+    switch(type)
+    {
+    case MODBUS_VALUE_UINT16:
+    case MODBUS_VALUE_INT16:
+        return 1;
+    case MODBUS_VALUE_UINT32:
+    case MODBUS_VALUE_INT32:
+    case MODBUS_VALUE_FLOAT32:
+        return 2;
+    case MODBUS_VALUE_UINT64:
+    case MODBUS_VALUE_INT64:
+    case MODBUS_VALUE_FLOAT64:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/*
+按字及字节顺序从words个寄存器中取出数值(高位在前拼接)。words为常量时循环可被展开。
+*/
+static inline uint64_t Modbus_Value_Load(const uint16_t *registers,size_t words,bool swap_words,bool swap_bytes)
+{
+    uint64_t raw=0;
+    for(size_t i=0; i<words; i++)
+    {
+        uint16_t word=registers[swap_words?(words-1-i):i];
+        if(swap_bytes)
+        {
+            word=(uint16_t)((word>>8)|(word<<8));
+        }
+        raw=(raw<<16)|word;
+    }
+    return raw;
+}
+
+/*
+按字及字节顺序将数值写入words个寄存器
+*/
+static inline void Modbus_Value_Store(uint16_t *registers,size_t words,bool swap_words,bool swap_bytes,uint64_t raw)
+{
+    for(size_t i=0; i<words; i++)
+    {
+        uint16_t word=(uint16_t)(raw>>(16*(words-1-i)));
+        if(swap_bytes)
+        {
+            word=(uint16_t)((word>>8)|(word<<8));
+        }
+        registers[swap_words?(words-1-i):i]=word;
+    }
+}
+
+bool Modbus_Value_Decode_Array(modbus_value_type_t type,modbus_value_order_t order,const uint16_t *registers,void *values,size_t count)
+{
+    if(registers==NULL || values==NULL || order>=MODBUS_VALUE_ORDER_MAX)
+    {
+        return false;
+    }
+
+    bool swap_words=(order==MODBUS_VALUE_ORDER_CDAB || order==MODBUS_VALUE_ORDER_DCBA);
+    bool swap_bytes=(order==MODBUS_VALUE_ORDER_BADC || order==MODBUS_VALUE_ORDER_DCBA);
+
+    //按类型分开循环,循环内只有移位及复制
+    switch(type)
+    {
+    case MODBUS_VALUE_UINT16:
+    {
+        uint16_t *out=(uint16_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            out[i]=(uint16_t)Modbus_Value_Load(&registers[i],1,false,swap_bytes);
+        }
+    }
+    break;
+    case MODBUS_VALUE_INT16:
+    {
+        int16_t *out=(int16_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            out[i]=(int16_t)(uint16_t)Modbus_Value_Load(&registers[i],1,false,swap_bytes);
+        }
+    }
+    break;
+    case MODBUS_VALUE_UINT32:
+    {
+        uint32_t *out=(uint32_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            out[i]=(uint32_t)Modbus_Value_Load(&registers[2*i],2,swap_words,swap_bytes);
+        }
+    }
+    break;
+    case MODBUS_VALUE_INT32:
+    {
+        int32_t *out=(int32_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            out[i]=(int32_t)(uint32_t)Modbus_Value_Load(&registers[2*i],2,swap_words,swap_bytes);
+        }
+    }
+    break;
+    case MODBUS_VALUE_FLOAT32:
+    {
+        float *out=(float *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            uint32_t raw=(uint32_t)Modbus_Value_Load(&registers[2*i],2,swap_words,swap_bytes);
+            memcpy(&out[i],&raw,sizeof(raw));
+        }
+    }
+    break;
+    case MODBUS_VALUE_UINT64:
+    {
+        uint64_t *out=(uint64_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            out[i]=Modbus_Value_Load(&registers[4*i],4,swap_words,swap_bytes);
+        }
+    }
+    break;
+    case MODBUS_VALUE_INT64:
+    {
+        int64_t *out=(int64_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            out[i]=(int64_t)Modbus_Value_Load(&registers[4*i],4,swap_words,swap_bytes);
+        }
+    }
+    break;
+    case MODBUS_VALUE_FLOAT64:
+    {
+        double *out=(double *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            uint64_t raw=Modbus_Value_Load(&registers[4*i],4,swap_words,swap_bytes);
+            memcpy(&out[i],&raw,sizeof(raw));
+        }
+    }
+    break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+bool Modbus_Value_Encode_Array(modbus_value_type_t type,modbus_value_order_t order,const void *values,uint16_t *registers,size_t count)
+{
+    if(registers==NULL || values==NULL || order>=MODBUS_VALUE_ORDER_MAX)
+    {
+        return false;
+    }
+
+    bool swap_words=(order==MODBUS_VALUE_ORDER_CDAB || order==MODBUS_VALUE_ORDER_DCBA);
+    bool swap_bytes=(order==MODBUS_VALUE_ORDER_BADC || order==MODBUS_VALUE_ORDER_DCBA);
+
+    switch(type)
+    {
+    case MODBUS_VALUE_UINT16:
+    case MODBUS_VALUE_INT16:
+    {
+        const uint16_t *in=(const uint16_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            Modbus_Value_Store(&registers[i],1,false,swap_bytes,in[i]);
+        }
+    }
+    break;
+    case MODBUS_VALUE_UINT32:
+    case MODBUS_VALUE_INT32:
+    {
+        const uint32_t *in=(const uint32_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            Modbus_Value_Store(&registers[2*i],2,swap_words,swap_bytes,in[i]);
+        }
+    }
+    break;
+    case MODBUS_VALUE_FLOAT32:
+    {
+        const float *in=(const float *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            uint32_t raw;
+            memcpy(&raw,&in[i],sizeof(raw));
+            Modbus_Value_Store(&registers[2*i],2,swap_words,swap_bytes,raw);
+        }
+    }
+    break;
+    case MODBUS_VALUE_UINT64:
+    case MODBUS_VALUE_INT64:
+    {
+        const uint64_t *in=(const uint64_t *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            Modbus_Value_Store(&registers[4*i],4,swap_words,swap_bytes,in[i]);
+        }
+    }
+    break;
+    case MODBUS_VALUE_FLOAT64:
+    {
+        const double *in=(const double *)values;
+        for(size_t i=0; i<count; i++)
+        {
+            uint64_t raw;
+            memcpy(&raw,&in[i],sizeof(raw));
+            Modbus_Value_Store(&registers[4*i],4,swap_words,swap_bytes,raw);
+        }
+    }
+    break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+/*
+检查描述数组,所有描述都正确且不超出寄存器数组时返回true
+*/
+static bool Modbus_Value_Check(const modbus_value_desc_t *desc,size_t desc_count,size_t register_count)
+{
+    if(desc==NULL && desc_count!=0)
+    {
+        return false;
+    }
+
+    for(size_t i=0; i<desc_count; i++)
+    {
+        size_t words=Modbus_Value_Registers(desc[i].type);
+        if(words==0 || desc[i].order>=MODBUS_VALUE_ORDER_MAX || desc[i].value==NULL || desc[i].offset>register_count || register_count-desc[i].offset<words)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Modbus_Value_Decode(const modbus_value_desc_t *desc,size_t desc_count,const uint16_t *registers,size_t register_count)
+{
+    if(registers==NULL || !Modbus_Value_Check(desc,desc_count,register_count))
+    {
+        return false;
+    }
+
+    for(size_t i=0; i<desc_count; i++)
+    {
+        Modbus_Value_Decode_Array(desc[i].type,desc[i].order,&registers[desc[i].offset],desc[i].value,1);
+    }
+
+    return true;
+}
+
+bool Modbus_Value_Encode(const modbus_value_desc_t *desc,size_t desc_count,uint16_t *registers,size_t register_count)
+{
+    if(registers==NULL || !Modbus_Value_Check(desc,desc_count,register_count))
+    {
+        return false;
+    }
+
+    for(size_t i=0; i<desc_count; i++)
+    {
+        Modbus_Value_Encode_Array(desc[i].type,desc[i].order,desc[i].value,&registers[desc[i].offset],1);
+    }
+
+    return true;
+}
@@ -0,0 +1,106 @@
+﻿/** \file ModbusValue.h
+ *  \brief     Modbus多寄存器数值(32/64位整数及浮点数)解码/编码头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_VALUE_H__
+#define __MODBUS_VALUE_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    MODBUS_VALUE_UINT16=0,/**< uint16_t,1个寄存器 */
+    MODBUS_VALUE_INT16,/**< int16_t,1个寄存器 */
+    MODBUS_VALUE_UINT32,/**< uint32_t,2个寄存器 */
+    MODBUS_VALUE_INT32,/**< int32_t,2个寄存器 */
+    MODBUS_VALUE_FLOAT32,/**< float(IEEE 754单精度),2个寄存器 */
+    MODBUS_VALUE_UINT64,/**< uint64_t,4个寄存器 */
+    MODBUS_VALUE_INT64,/**< int64_t,4个寄存器 */
+    MODBUS_VALUE_FLOAT64,/**< double(IEEE 754双精度),4个寄存器 */
+    MODBUS_VALUE_MAX,/**< 类型的数量 */
+} modbus_value_type_t/**< 数值类型 */;
+
+typedef enum
+{
+    MODBUS_VALUE_ORDER_ABCD=0,/**< 高字在前,字内高字节在前(Modbus标准的大端) */
+    MODBUS_VALUE_ORDER_CDAB,/**< 低字在前,字内高字节在前(字交换) */
+    MODBUS_VALUE_ORDER_BADC,/**< 高字在前,字内低字节在前(字节交换) */
+    MODBUS_VALUE_ORDER_DCBA,/**< 低字在前,字内低字节在前(小端) */
+    MODBUS_VALUE_ORDER_MAX,/**< 顺序的数量 */
+} modbus_value_order_t/**< 数值在寄存器中的字及字节顺序(以32位数值0xAABBCCDD的字节表示) */;
+
+typedef struct
+{
+    size_t offset;/**< 数值第一个寄存器相对于寄存器数组起始的偏移 */
+    modbus_value_type_t type;/**< 类型 */
+    modbus_value_order_t order;/**< 字及字节顺序 */
+    void *value;/**< 值(指向与类型对应的变量,如MODBUS_VALUE_FLOAT32时为float *) */
+} modbus_value_desc_t/**< 数值描述,描述数组即一组寄存器的布局 */;
+
+/** \brief 数值类型占用的寄存器数量
+ *
+ * \param type 类型
+ * \return 寄存器数量,类型不正确时为0
+ *
+ */
+size_t Modbus_Value_Registers(modbus_value_type_t type);
+
+/** \brief 按描述数组将寄存器解码为数值
+ *
+ * \param desc 描述数组
+ * \param desc_count 描述数量
+ * \param registers 寄存器数组(如Modbus_Master_Read_Hold_Register读取的数据)
+ * \param register_count 寄存器数量
+ * \return 是否成功(描述不正确或超出寄存器数组时失败,此时不写入任何数值)
+ *
+ */
+bool Modbus_Value_Decode(const modbus_value_desc_t *desc,size_t desc_count,const uint16_t *registers,size_t register_count);
+
+/** \brief 按描述数组将数值编码为寄存器(如用于Modbus_Master_Write_Hold_Register),描述未覆盖的寄存器不修改
+ *
+ * \param desc 描述数组
+ * \param desc_count 描述数量
+ * \param registers 寄存器数组
+ * \param register_count 寄存器数量
+ * \return 是否成功(描述不正确或超出寄存器数组时失败,此时不修改寄存器)
+ *
+ */
+bool Modbus_Value_Encode(const modbus_value_desc_t *desc,size_t desc_count,uint16_t *registers,size_t register_count);
+
+/** \brief 将连续的同类型数值解码(批量转换,循环内没有分支)
+ *
+ * \param type 类型
+ * \param order 字及字节顺序
+ * \param registers 寄存器数组,长度为count*Modbus_Value_Registers(type)
+ * \param values 数值数组(与类型对应,如MODBUS_VALUE_FLOAT32时为float *)
+ * \param count 数值数量
+ * \return 是否成功
+ *
+ */
+bool Modbus_Value_Decode_Array(modbus_value_type_t type,modbus_value_order_t order,const uint16_t *registers,void *values,size_t count);
+
+/** \brief 将连续的同类型数值编码(批量转换,循环内没有分支)
+ *
+ * \param type 类型
+ * \param order 字及字节顺序
+ * \param values 数值数组(与类型对应)
+ * \param registers 寄存器数组,长度为count*Modbus_Value_Registers(type)
+ * \param count 数值数量
+ * \return 是否成功
+ *
+ */
+bool Modbus_Value_Encode_Array(modbus_value_type_t type,modbus_value_order_t order,const void *values,uint16_t *registers,size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,264 @@
+﻿/** \file ModbusWriteQueue.c
+ *  \brief     Modbus主机写入队列(合并相邻的写入,丢弃被覆盖的写入)C源代码
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#include "ModbusWriteQueue.h"
+
+void Modbus_Write_Queue_Init(modbus_write_queue_t *queue,modbus_write_entry_t *entries,size_t capacity)
+{
+    if(queue==NULL)
+    {
+        return;
+    }
+
+    memset(queue,0,sizeof(modbus_write_queue_t));
+    queue->entries=entries;
+    queue->capacity=capacity;
+    queue->max_bits=MODBUS_MAX_WRITE_BITS;
+    queue->max_registers=MODBUS_MAX_WRITE_REGISTERS;
+}
+
+/*
+在当前屏障段中查找同一地址的待写入值。队列按加入顺序存放,遇到较早的屏障段即可停止。
+*/
+static modbus_write_entry_t *Modbus_Write_Queue_Find(modbus_write_queue_t *queue,uint8_t slave_addr,modbus_table_t table,uint16_t addr)
+{
+    for(size_t i=queue->count; i>0; i--)
+    {
+        modbus_write_entry_t *entry=&queue->entries[i-1];
+        if(entry->epoch!=queue->epoch)
+        {
+            break;
+        }
+        if(entry->slave_addr==slave_addr && entry->table==table && entry->addr==addr)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static bool Modbus_Write_Queue_Push(modbus_write_queue_t *queue,uint8_t slave_addr,modbus_table_t table,uint16_t start_addr,const bool *bits,const uint16_t *registers,size_t number)
+{
+    if(queue==NULL || (queue->entries==NULL && queue->capacity!=0) || number==0 || ((size_t)start_addr+number)>0x10000)
+    {
+        return false;
+    }
+
+    //先检查空间,保证失败时不加入任何数据
+    size_t new_count=0;
+    for(size_t i=0; i<number; i++)
+    {
+        if(Modbus_Write_Queue_Find(queue,slave_addr,table,(uint16_t)(start_addr+i))==NULL)
+        {
+            new_count++;
+        }
+    }
+    if(queue->count+new_count>queue->capacity)
+    {
+        return false;
+    }
+
+    for(size_t i=0; i<number; i++)
+    {
+        uint16_t addr=(uint16_t)(start_addr+i);
+        uint16_t value=(bits!=NULL)?(bits[i]?1:0):registers[i];
+        modbus_write_entry_t *entry=Modbus_Write_Queue_Find(queue,slave_addr,table,addr);
+        if(entry!=NULL)
+        {
+            //旧值尚未发送,直接覆盖
+            entry->value=value;
+            queue->superseded++;
+            continue;
+        }
+        entry=&queue->entries[queue->count++];
+        entry->slave_addr=slave_addr;
+        entry->table=table;
+        entry->addr=addr;
+        entry->value=value;
+        entry->epoch=queue->epoch;
+    }
+
+    return true;
+}
+
+bool Modbus_Write_Queue_Write_OX(modbus_write_queue_t *queue,uint8_t slave_addr,uint16_t start_addr,const bool *data,size_t number)
+{
+    if(data==NULL)
+    {
+        return false;
+    }
+    return Modbus_Write_Queue_Push(queue,slave_addr,MODBUS_TABLE_OX,start_addr,data,NULL,number);
+}
+
+bool Modbus_Write_Queue_Write_Hold_Register(modbus_write_queue_t *queue,uint8_t slave_addr,uint16_t start_addr,const uint16_t *data,size_t number)
+{
+    if(data==NULL)
+    {
+        return false;
+    }
+    return Modbus_Write_Queue_Push(queue,slave_addr,MODBUS_TABLE_HOLD_REGISTER,start_addr,NULL,data,number);
+}
+
+void Modbus_Write_Queue_Barrier(modbus_write_queue_t *queue)
+{
+    if(queue==NULL)
+    {
+        return;
+    }
+
+    queue->epoch++;
+}
+
+static bool Modbus_Write_Entry_Same_Group(const modbus_write_entry_t *a,const modbus_write_entry_t *b)
+{
+    return a->slave_addr==b->slave_addr && a->table==b->table && a->epoch==b->epoch;
+}
+
+size_t Modbus_Write_Queue_Flush(modbus_write_queue_t *queue,modbus_master_context_t *ctx,uint8_t *buff,size_t buff_length)
+{
+    if(queue==NULL || ctx==NULL)
+    {
+        return 0;
+    }
+
+    union
+    {
+        bool bits[MODBUS_MAX_WRITE_BITS];
+        uint16_t registers[MODBUS_MAX_WRITE_REGISTERS];
+    } data;
+
+    //请求失败的从机(按从机地址的位图)
+    uint8_t blocked[32]= {0};
+    //有请求失败时,失败的写入所在的屏障段(队列中较早的屏障段在前)
+    bool failed=false;
+    uint32_t failed_epoch=0;
+
+    uint8_t slave_addr=ctx->slave_addr;
+    size_t success=0;
+    size_t i=0;
+    while(i<queue->count)
+    {
+        //最早加入的写入,同一从机更早的写入均已发送(或该从机已失败)
+        modbus_write_entry_t first=queue->entries[i];
+        if(failed && first.epoch!=failed_epoch)
+        {
+            //屏障之前有写入失败,之后的写入(所有从机)本次均不发送
+            break;
+        }
+        if((blocked[first.slave_addr/8]&(1<<(first.slave_addr%8)))!=0)
+        {
+            i++;
+            continue;
+        }
+
+        bool bits=(first.table==MODBUS_TABLE_OX);
+        size_t max_number=bits?queue->max_bits:queue->max_registers;
+        if(bits)
+        {
+            if(max_number>MODBUS_MAX_WRITE_BITS)
+            {
+                max_number=MODBUS_MAX_WRITE_BITS;
+            }
+        }
+        else if(max_number>MODBUS_MAX_WRITE_REGISTERS)
+        {
+            max_number=MODBUS_MAX_WRITE_REGISTERS;
+        }
+        if(max_number==0)
+        {
+            max_number=1;
+        }
+
+        //按加入顺序向两侧扩展连续的地址,遇到同一从机中不能合并的写入即停止,
+        //合并的请求不越过同一从机更早的写入,同一从机的写入按加入顺序发送
+        size_t start=first.addr;
+        size_t end=start+1;
+        for(size_t j=i+1; j<queue->count && end-start<max_number; j++)
+        {
+            const modbus_write_entry_t *entry=&queue->entries[j];
+            if(entry->slave_addr!=first.slave_addr)
+            {
+                continue;
+            }
+            if(!Modbus_Write_Entry_Same_Group(entry,&first))
+            {
+                break;
+            }
+            if(entry->addr==end)
+            {
+                end++;
+            }
+            else if((size_t)entry->addr+1==start)
+            {
+                start--;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        for(size_t j=0; j<queue->count; j++)
+        {
+            const modbus_write_entry_t *entry=&queue->entries[j];
+            if(Modbus_Write_Entry_Same_Group(entry,&first) && entry->addr>=start && entry->addr<end)
+            {
+                if(bits)
+                {
+                    data.bits[entry->addr-start]=(entry->value!=0);
+                }
+                else
+                {
+                    data.registers[entry->addr-start]=entry->value;
+                }
+            }
+        }
+
+        ctx->slave_addr=first.slave_addr;
+        bool ret=false;
+        if(bits)
+        {
+            ret=Modbus_Master_Write_OX(ctx,(uint16_t)start,data.bits,end-start,buff,buff_length);
+        }
+        else
+        {
+            ret=Modbus_Master_Write_Hold_Register(ctx,(uint16_t)start,data.registers,end-start,buff,buff_length);
+        }
+
+        if(!ret)
+        {
+            blocked[first.slave_addr/8]|=(1<<(first.slave_addr%8));
+            if(!failed)
+            {
+                failed=true;
+                failed_epoch=first.epoch;
+            }
+            i++;
+            continue;
+        }
+
+        success++;
+
+        //移除已发送的写入,保持其余写入的顺序
+        size_t count=0;
+        for(size_t j=0; j<queue->count; j++)
+        {
+            const modbus_write_entry_t *entry=&queue->entries[j];
+            if(Modbus_Write_Entry_Same_Group(entry,&first) && entry->addr>=start && entry->addr<end)
+            {
+                continue;
+            }
+            queue->entries[count++]=*entry;
+        }
+        queue->count=count;
+    }
+    ctx->slave_addr=slave_addr;
+
+    return success;
+}
@@ -0,0 +1,97 @@
+﻿/** \file ModbusWriteQueue.h
+ *  \brief     Modbus主机写入队列(合并相邻的写入,丢弃被覆盖的写入)头文件
+ *  \author    何亚红
+ *  \version   20220203
+ *  \date      2022
+ *  \copyright MIT License.
+ */
+
+#ifndef __MODBUS_WRITE_QUEUE_H__
+#define __MODBUS_WRITE_QUEUE_H__
+
+#include "Modbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    uint8_t slave_addr;/**< 从机地址 */
+    modbus_table_t table;/**< 表(MODBUS_TABLE_OX或MODBUS_TABLE_HOLD_REGISTER) */
+    uint16_t addr;/**< 地址 */
+    uint16_t value;/**< 值(线圈为0或1) */
+    uint32_t epoch;/**< 所属屏障段,合并及覆盖不跨越屏障 */
+} modbus_write_entry_t/**< 待写入的单个地址 */;
+
+typedef struct
+{
+    modbus_write_entry_t *entries;/**< 队列数组(由用户定义),按加入顺序存放 */
+    size_t capacity;/**< 队列数组长度 */
+    size_t count;/**< 待写入的数量 */
+    uint32_t epoch;/**< 当前屏障段 */
+    size_t max_bits;/**< 单个请求最多写入的线圈数量(不超过MODBUS_MAX_WRITE_BITS) */
+    size_t max_registers;/**< 单个请求最多写入的寄存器数量(不超过MODBUS_MAX_WRITE_REGISTERS) */
+    size_t superseded;/**< 统计:被更新的值覆盖(未发送)的写入数量 */
+} modbus_write_queue_t/**< 写入队列,不使用动态内存 */;
+
+/** \brief 初始化写入队列(单个请求的最大数量为协议允许的最大值)
+ *
+ * \param queue 写入队列
+ * \param entries 队列数组
+ * \param capacity 队列数组长度
+ *
+ */
+void Modbus_Write_Queue_Init(modbus_write_queue_t *queue,modbus_write_entry_t *entries,size_t capacity);
+
+/** \brief 加入写线圈。若当前屏障段中已有同一地址的待写入值,则直接覆盖。
+ *
+ * \param queue 写入队列
+ * \param slave_addr 从机地址
+ * \param start_addr 起始地址
+ * \param data 数据
+ * \param number 数量
+ * \return 是否成功(队列空间不足时失败,此时不加入任何数据)
+ *
+ */
+bool Modbus_Write_Queue_Write_OX(modbus_write_queue_t *queue,uint8_t slave_addr,uint16_t start_addr,const bool *data,size_t number);
+
+/** \brief 加入写保持寄存器。若当前屏障段中已有同一地址的待写入值,则直接覆盖。
+ *
+ * \param queue 写入队列
+ * \param slave_addr 从机地址
+ * \param start_addr 起始地址
+ * \param data 数据
+ * \param number 数量
+ * \return 是否成功(队列空间不足时失败,此时不加入任何数据)
+ *
+ */
+bool Modbus_Write_Queue_Write_Hold_Register(modbus_write_queue_t *queue,uint8_t slave_addr,uint16_t start_addr,const uint16_t *data,size_t number);
+
+/** \brief 加入屏障:屏障之前的写入全部发送完成后才发送屏障之后的写入,且合并及覆盖不跨越屏障
+ *
+ * \param queue 写入队列
+ *
+ */
+void Modbus_Write_Queue_Barrier(modbus_write_queue_t *queue);
+
+/** \brief 发送队列中的写入(阻塞)。
+ *
+ * 同一从机同一屏障段中按加入顺序相邻且地址连续的写入合并为一个请求(数量为1时使用0x05/0x06功能码)。
+ * 同一从机的写入按加入顺序发送,合并的请求不越过同一从机中未合并的较早写入。
+ * 某个从机的请求失败后,本次不再发送该从机的写入,也不再发送下一屏障段的写入(所有从机),失败的写入保留在队列中。
+ *
+ * \param queue 写入队列
+ * \param ctx 主机上下文,slave_addr在发送时按请求修改,发送后恢复
+ * \param buff 缓冲,用于发送和接收数据，尽量大
+ * \param buff_length 缓冲长度
+ * \return 成功的请求数量
+ *
+ */
+size_t Modbus_Write_Queue_Flush(modbus_write_queue_t *queue,modbus_master_context_t *ctx,uint8_t *buff,size_t buff_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,9 @@
 ﻿#include "argtable3.h"
 #include "Modbus.h"
+#include "ModbusRTUDeframer.h"
 #include <string>
 #include <map>
+#include <chrono>
 
 extern "C"
 {
@@ -147,14 +149,34 @@ int main(int argc,char *argv[])
     ctx.read_hold_register=mb_read_hold_register;
     ctx.read_input_register=mb_read_input_register;
 
+    //初始化分帧器(115200,8N1:单个字符87us,t1.5与t3.5使用固定值750us与1750us)
+    static modbus_rtu_deframer_t deframer;
+    Modbus_RTU_Deframer_Init(&deframer,MODBUS_RTU_DEFRAMER_REQUEST,87,750,1750);
+    auto timestamp=[]()->uint32_t
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+
     while(true)
     {
-        uint8_t rxbuff[4096]= {0},txbuff[4096]= {0};
+        uint8_t rxbuff[4096]= {0},frame[MODBUS_RTU_MAX_ADU_LENGTH]= {0},txbuff[MODBUS_RTU_MAX_ADU_LENGTH]= {0};
         long bytesread=readFromSerialPort(ComHandle,(char *)rxbuff,sizeof(rxbuff));
-        if(bytesread>0)
+        uint32_t now=timestamp();
+        size_t offset=0;
+        do
         {
-            Modbus_Slave_Parse_Input(&ctx,rxbuff,bytesread,txbuff,sizeof(txbuff));
+            //串口读取的数据可能是半帧或多帧,由分帧器拆分成完整的帧
+            if(bytesread>0 && offset<(size_t)bytesread)
+            {
+                offset+=Modbus_RTU_Deframer_Feed(&deframer,&rxbuff[offset],bytesread-offset,now);
+            }
+            size_t frame_length=0;
+            while((frame_length=Modbus_RTU_Deframer_Poll(&deframer,now,frame,sizeof(frame)))>0)
+            {
+                Modbus_Slave_Parse_Input(&ctx,frame,frame_length,txbuff,sizeof(txbuff));
+            }
         }
+        while(bytesread>0 && offset<(size_t)bytesread);
     }
 
 
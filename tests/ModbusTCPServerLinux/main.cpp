@@ -0,0 +1,362 @@
+﻿#include "argtable3.h"
+#include "Modbus.h"
+#include "ModbusRegisterBank.h"
+#include <string>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+CLI程序命令参数表
+*/
+static struct arg_int *argport=arg_int0("p","port","<n>","监听端口(默认502)");
+static struct arg_int *argthreads=arg_int0("t","threads","<n>","事件循环线程数(默认1,每个线程一个epoll及SO_REUSEPORT监听套接字)");
+static struct arg_lit *argstats=arg_lit0("s","stats","每秒打印请求数");
+static struct arg_lit *help=arg_lit0(NULL,"help", "打印帮助");
+
+static void * argtable[]=
+{
+    argport,
+    argthreads,
+    argstats,
+    help,
+    arg_end(20),
+};
+
+static void argtable_parse_arg(int argc,char *argv[])
+{
+    int nerrors = arg_parse(argc,argv,argtable);
+    if(nerrors>0 || help->count>0)
+    {
+        if(nerrors>0 && help->count == 0)
+        {
+            printf("命令行参数有误!\r\n");
+        }
+        printf("%s:\r\n","帮助");
+        printf("%s ",argv[0]);
+        arg_print_syntax(stdout,argtable,"\r\n");
+        arg_print_glossary(stdout,argtable,"%-40s %s\n");
+        //退出程序
+        exit(0);
+    }
+
+
+}
+
+/*
+modbus 从机相关,所有连接共享同一份寄存器存储
+*/
+const uint8_t slave_addr=1;
+
+MODBUS_REGISTER_BANK_DEFINE_BITS(IX_table,0x10000);
+MODBUS_REGISTER_BANK_DEFINE_BITS(OX_table,0x10000);
+MODBUS_REGISTER_BANK_DEFINE_REGISTERS(InputRegister_table,0x10000);
+MODBUS_REGISTER_BANK_DEFINE_REGISTERS(HoldRegister_table,0x10000);
+static modbus_register_bank_t bank;
+
+//多个线程访问寄存器存储时加锁(每次处理一批请求加锁一次)
+static std::mutex bank_lock;
+
+static std::atomic<uint64_t> request_count(0);
+
+/*
+连接,每个连接有自己的接收缓冲及发送缓冲。
+一次接收到的多个请求(流水线)依次处理,回应追加到发送缓冲后一次发送。
+*/
+struct connection
+{
+    int fd=-1;
+    uint8_t rx[MODBUS_TCP_MAX_ADU_LENGTH*16];
+    size_t rx_length=0;
+    std::vector<uint8_t> tx;
+    size_t tx_pos=0;
+};
+
+//从机回调没有用户数据参数,使用线程局部变量指向正在处理的连接
+static thread_local connection *current_connection=NULL;
+
+//输出回调,回应追加到当前连接的发送缓冲
+void  mb_output(uint8_t *data, size_t data_length)
+{
+    if(current_connection!=NULL)
+    {
+        current_connection->tx.insert(current_connection->tx.end(),data,data+data_length);
+    }
+}
+
+static bool set_nonblocking(int fd)
+{
+    int flags=fcntl(fd,F_GETFL,0);
+    return flags>=0 && fcntl(fd,F_SETFL,flags|O_NONBLOCK)==0;
+}
+
+static int open_listener(uint16_t port)
+{
+    int fd=socket(AF_INET,SOCK_STREAM,0);
+    if(fd<0)
+    {
+        return -1;
+    }
+
+    int on=1;
+    setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+    setsockopt(fd,SOL_SOCKET,SO_REUSEPORT,&on,sizeof(on));
+
+    sockaddr_in addr= {};
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_ANY);
+    addr.sin_port=htons(port);
+    if(bind(fd,(sockaddr *)&addr,sizeof(addr))!=0 || listen(fd,SOMAXCONN)!=0 || !set_nonblocking(fd))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+发送发送缓冲中的数据,返回false时连接已断开。
+未发送完时只等待可写(不再读取新的请求),发送完后恢复读取。
+*/
+static bool flush_connection(int epfd,connection *conn)
+{
+    while(conn->tx_pos<conn->tx.size())
+    {
+        ssize_t ret=send(conn->fd,&conn->tx[conn->tx_pos],conn->tx.size()-conn->tx_pos,MSG_NOSIGNAL);
+        if(ret>0)
+        {
+            conn->tx_pos+=ret;
+            continue;
+        }
+        if(ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+        {
+            epoll_event ev= {};
+            ev.events=EPOLLOUT;
+            ev.data.ptr=conn;
+            epoll_ctl(epfd,EPOLL_CTL_MOD,conn->fd,&ev);
+            return true;
+        }
+        if(ret<0 && errno==EINTR)
+        {
+            continue;
+        }
+        return false;
+    }
+
+    bool waiting=(conn->tx_pos!=0);
+    conn->tx.clear();
+    conn->tx_pos=0;
+    if(waiting)
+    {
+        epoll_event ev= {};
+        ev.events=EPOLLIN;
+        ev.data.ptr=conn;
+        epoll_ctl(epfd,EPOLL_CTL_MOD,conn->fd,&ev);
+    }
+    return true;
+}
+
+/*
+处理接收缓冲中所有完整的请求,返回false时请求格式错误(应断开连接)
+*/
+static bool process_connection(modbus_slave_context_t *ctx,connection *conn)
+{
+    uint8_t txbuff[MODBUS_TCP_MAX_ADU_LENGTH];
+    size_t pos=0;
+    bool ret=true;
+    uint64_t count=0;
+
+    {
+        std::lock_guard<std::mutex> lock(bank_lock);
+        current_connection=conn;
+        while(pos<conn->rx_length)
+        {
+            int frame_length=Modbus_TCP_Predict_Length(&conn->rx[pos],conn->rx_length-pos);
+            if(frame_length<0)
+            {
+                ret=false;
+                break;
+            }
+            if(frame_length==0 || (size_t)frame_length>conn->rx_length-pos)
+            {
+                //不足一帧,等待剩余部分
+                break;
+            }
+            Modbus_Slave_Parse_Input_TCP(ctx,&conn->rx[pos],frame_length,txbuff,sizeof(txbuff));
+            pos+=frame_length;
+            count++;
+        }
+        current_connection=NULL;
+    }
+
+    request_count+=count;
+    if(pos>0)
+    {
+        memmove(conn->rx,&conn->rx[pos],conn->rx_length-pos);
+        conn->rx_length-=pos;
+    }
+
+    return ret;
+}
+
+static void close_connection(int epfd,connection *conn,std::unordered_map<int,connection *> &connections)
+{
+    epoll_ctl(epfd,EPOLL_CTL_DEL,conn->fd,NULL);
+    close(conn->fd);
+    connections.erase(conn->fd);
+    delete conn;
+}
+
+/*
+事件循环(每个线程一个)
+*/
+static void event_loop(uint16_t port)
+{
+    int listen_fd=open_listener(port);
+    int epfd=epoll_create1(0);
+    if(listen_fd<0 || epfd<0)
+    {
+        printf("监听端口%d失败!\r\n",(int)port);
+        exit(0);
+    }
+
+    //初始化modbus上下文
+    modbus_slave_context_t ctx= {0};
+    ctx.slave_addr=slave_addr;
+    ctx.output=mb_output;
+    ctx.bank=&bank;
+
+    epoll_event ev= {};
+    ev.events=EPOLLIN;
+    ev.data.ptr=NULL;
+    epoll_ctl(epfd,EPOLL_CTL_ADD,listen_fd,&ev);
+
+    std::unordered_map<int,connection *> connections;
+    epoll_event events[256];
+    while(true)
+    {
+        int n=epoll_wait(epfd,events,sizeof(events)/sizeof(events[0]),-1);
+        for(int i=0; i<n; i++)
+        {
+            connection *conn=(connection *)events[i].data.ptr;
+            if(conn==NULL)
+            {
+                //新连接
+                int fd=-1;
+                while((fd=accept(listen_fd,NULL,NULL))>=0)
+                {
+                    int on=1;
+                    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+                    set_nonblocking(fd);
+                    connection *c=new connection;
+                    c->fd=fd;
+                    connections[fd]=c;
+                    epoll_event cev= {};
+                    cev.events=EPOLLIN;
+                    cev.data.ptr=c;
+                    epoll_ctl(epfd,EPOLL_CTL_ADD,fd,&cev);
+                }
+                continue;
+            }
+
+            if((events[i].events&EPOLLOUT)!=0)
+            {
+                if(!flush_connection(epfd,conn))
+                {
+                    close_connection(epfd,conn,connections);
+                }
+                continue;
+            }
+
+            if((events[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR))!=0)
+            {
+                ssize_t ret=recv(conn->fd,&conn->rx[conn->rx_length],sizeof(conn->rx)-conn->rx_length,0);
+                if(ret<0 && (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR))
+                {
+                    continue;
+                }
+                if(ret<=0)
+                {
+                    close_connection(epfd,conn,connections);
+                    continue;
+                }
+                conn->rx_length+=ret;
+
+                if(!process_connection(&ctx,conn) || !flush_connection(epfd,conn))
+                {
+                    close_connection(epfd,conn,connections);
+                }
+            }
+        }
+    }
+}
+
+/*
+主程序
+*/
+int main(int argc,char *argv[])
+{
+    //关闭输出缓冲
+    setbuf(stdout,NULL);
+
+    //检查命令参数
+    argtable_parse_arg(argc,argv);
+
+    uint16_t port=(argport->count>0)?argport->ival[0]:502;
+    int threads=(argthreads->count>0)?argthreads->ival[0]:1;
+    if(threads<1)
+    {
+        threads=1;
+    }
+
+    signal(SIGPIPE,SIG_IGN);
+
+    //初始化寄存器存储:输入点奇数为真,输出线圈偶数为真,保持寄存器为地址,输入寄存器为地址+1
+    Modbus_Register_Bank_Init(&bank);
+    Modbus_Register_Bank_Set_Table(&bank,MODBUS_TABLE_IX,0,0x10000,IX_table);
+    Modbus_Register_Bank_Set_Table(&bank,MODBUS_TABLE_OX,0,0x10000,OX_table);
+    Modbus_Register_Bank_Set_Table(&bank,MODBUS_TABLE_INPUT_REGISTER,0,0x10000,InputRegister_table);
+    Modbus_Register_Bank_Set_Table(&bank,MODBUS_TABLE_HOLD_REGISTER,0,0x10000,HoldRegister_table);
+    for(size_t addr=0; addr<0x10000; addr++)
+    {
+        Modbus_Register_Bank_Set_Bit(&bank,MODBUS_TABLE_IX,addr,(addr%2)==1);
+        Modbus_Register_Bank_Set_Bit(&bank,MODBUS_TABLE_OX,addr,(addr%2)==0);
+        Modbus_Register_Bank_Set_Register(&bank,MODBUS_TABLE_HOLD_REGISTER,addr,addr);
+        Modbus_Register_Bank_Set_Register(&bank,MODBUS_TABLE_INPUT_REGISTER,addr,addr+1);
+    }
+
+    printf("Modbus TCP从机(从机地址%d)监听端口%d,线程数%d\r\n",(int)slave_addr,(int)port,threads);
+
+    std::vector<std::thread> loops;
+    for(int i=0; i<threads; i++)
+    {
+        loops.emplace_back(event_loop,port);
+    }
+
+    uint64_t last_count=0;
+    while(true)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t count=request_count;
+        if(argstats->count>0)
+        {
+            printf("请求数/秒:%llu\r\n",(unsigned long long)(count-last_count));
+        }
+        last_count=count;
+    }
+
+    return 0;
+}